@@ -0,0 +1,16 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+namespace bench
+{
+  /* average duration of one call of f over repeats calls, in units of Period (std::micro, std::nano, ...) */
+  template<typename Period, typename F> double measure(size_t repeats, F&& f)
+  {
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < repeats; ++r)
+      f();
+    return std::chrono::duration<double, Period>(std::chrono::steady_clock::now() - start).count() / repeats;
+  }
+}
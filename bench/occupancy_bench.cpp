@@ -0,0 +1,66 @@
+#include "model/model.h"
+#include "bench.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+using namespace nb;
+
+/* compares Layer::piece, which goes through the occupancy index, with the linear scan over the pieces of the layer
+   it replaced, on mosaic like layers from 1k to 100k pieces queried at random cells */
+
+namespace
+{
+  std::optional<Piece> scan(const std::vector<Piece>& pieces, const coord2d_t& coord)
+  {
+    for (const Piece& piece : pieces)
+      if (piece.bounds().contains(coord))
+        return piece;
+
+    return std::nullopt;
+  }
+}
+
+int main()
+{
+  std::mt19937 rng(42);
+  volatile size_t sink = 0;
+
+  std::printf("%10s %14s %14s %10s\n", "pieces", "index", "scan", "speedup");
+
+  for (coord_t side : { 32, 100, 317 })
+  {
+    /* grid of 2x2 pieces with a few holes so that some lookups miss */
+    nb::Model model;
+    model.prepareLayers(1);
+
+    for (coord_t y = 0; y < side; ++y)
+      for (coord_t x = 0; x < side; ++x)
+        if (rng() % 10)
+          model.addPiece(0, Piece(coord2d_t(x * 2, y * 2), nullptr, PieceOrientation::North, PieceType::Square, size2d_t(2, 2)));
+
+    const Layer* layer = model.layer(0);
+    const std::vector<Piece> pieces(layer->pieces().begin(), layer->pieces().end());
+
+    std::vector<coord2d_t> queries(1024);
+    for (coord2d_t& query : queries)
+      query = coord2d_t(rng() % (side * 2), rng() % (side * 2));
+
+    size_t next = 0;
+    const size_t repeats = std::max<size_t>(1000, 100000000 / pieces.size());
+
+    const double index = bench::measure<std::nano>(repeats, [&] {
+      sink = sink + layer->piece(queries[next++ & 1023]).has_value();
+    });
+
+    const double linear = bench::measure<std::nano>(std::max<size_t>(100, repeats / 100), [&] {
+      sink = sink + scan(pieces, queries[next++ & 1023]).has_value();
+    });
+
+    std::printf("%10zu %12.1fns %12.1fns %9.0fx\n", pieces.size(), index, linear, linear / index);
+  }
+
+  return 0;
+}
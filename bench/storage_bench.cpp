@@ -0,0 +1,47 @@
+#include "model/storage.h"
+#include "bench.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+using namespace nb;
+
+/* compares the vectorized translate of PieceStorage with moving every piece of an array of pieces, which is how layers
+   stored them before, on layers from 10k to 1M pieces, lookups by coordinate are measured by occupancy_bench */
+
+int main()
+{
+  std::mt19937 rng(42);
+  volatile size_t sink = 0;
+
+  std::printf("%10s %14s %14s %10s\n", "pieces", "shift", "shift array", "speedup");
+
+  for (size_t count : { size_t(10000), size_t(100000), size_t(1000000) })
+  {
+    PieceStorage storage;
+    std::vector<Piece> pieces;
+    storage.reserve(count);
+    pieces.reserve(count);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+      Piece piece(coord2d_t(rng() % 20000 - 10000, rng() % 20000 - 10000), nullptr, PieceOrientation::North, PieceType::Square, size2d_t(1 + rng() % 4, 1 + rng() % 4));
+      storage.push_back(piece);
+      pieces.push_back(piece);
+    }
+
+    const size_t repeats = std::max<size_t>(1, 10000000 / count);
+
+    /* shifts go back and forth so that coordinates stay in range */
+    coord_t delta = 1;
+    const double shift = bench::measure<std::micro>(repeats, [&] { storage.translate(delta, delta); delta = -delta; });
+    const double shiftArray = bench::measure<std::micro>(repeats, [&] { for (Piece& piece : pieces) piece.moveBy(delta, delta); delta = -delta; });
+    sink = sink + storage.xs()[0] + pieces[0].x();
+
+    std::printf("%10zu %12.1fus %12.1fus %9.1fx\n", count, shift, shiftArray, shiftArray / shift);
+  }
+
+  return 0;
+}
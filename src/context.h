@@ -52,6 +52,8 @@ struct Context
   Preferences prefs;
 
   std::unique_ptr<nb::Model> model;
+  std::unique_ptr<nb::History> history;
+  std::unique_ptr<nb::Connectivity> connectivity;
   std::unique_ptr<gfx::Renderer> renderer;
   std::unique_ptr<InputHandler> input;
   std::unique_ptr<nb::Piece> brush;
@@ -59,5 +61,6 @@ struct Context
   std::unique_ptr<Data> data;
   std::unique_ptr<Loader> loader;
 
-  Context();
+  /* a headless context has no renderer, input nor ui so it can be used without a window */
+  Context(bool headless = false);
 };
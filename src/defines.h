@@ -20,6 +20,8 @@ namespace nb
   class Layer;
   class Model;
   class Piece;
+  class History;
+  class Connectivity;
 }
 
 #include <map>
@@ -30,8 +32,13 @@ namespace nb
 struct FlatShader
 {
   raylib::ShaderUnmanaged shader;
-  unsigned int locationInstanceTransform;
-  unsigned int locationColorShade;
+  unsigned int locationInstancePosition;
+  unsigned int locationInstanceShape;
+  int locationCellSize;
+  int locationElevation;
+  int locationViewPosition;
+  int locationIdBase;
+  int locationOrigin;
   
   raylib::ShaderUnmanaged* operator->() { return &shader; }
 };
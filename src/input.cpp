@@ -1,6 +1,8 @@
 #include "input.h"
 
 #include "model/model.h"
+#include "model/validation.h"
+#include "model/history.h"
 #include "renderer.h"
 #include "context.h"
 
@@ -40,16 +42,16 @@ void InputHandler::handle(nb::Model* model)
   vec2 position = GetMousePosition();
 
   bool any = false;
+  const bounds2d_t area = _context->renderer->_topDown.area();
   for (layer_index_t i = 0; i < model->layerCount(); ++i)
   {
-    float y = (gfx::Renderer::MOCK_LAYER_SIZE * Data::Constants::LAYER2D_CELL_SIZE.height) * i + (Data::Constants::LAYER2D_SPACING * i);
-    rect bounds = rect(_context->prefs.gridTopPosition().x, _context->prefs.gridTopPosition().y + y, gfx::Renderer::MOCK_LAYER_SIZE * Data::Constants::LAYER2D_CELL_SIZE.width, gfx::Renderer::MOCK_LAYER_SIZE * Data::Constants::LAYER2D_CELL_SIZE.height);
+    rect bounds = _context->renderer->_topDown.screenBounds(i);
 
     /* if mouse is inside 2d layer grid */
     if (bounds.CheckCollision(position))
     {
       auto relative = position - bounds.Origin();
-      coord2d_t cell = coord2d_t(relative.x / Data::Constants::LAYER2D_CELL_SIZE.width, relative.y / Data::Constants::LAYER2D_CELL_SIZE.height);
+      coord2d_t cell = area.min + coord2d_t(relative.x / Data::Constants::LAYER2D_CELL_SIZE.width, relative.y / Data::Constants::LAYER2D_CELL_SIZE.height);
       _hover = coord3d_t(cell, _context->renderer->_topDown.begin().index() - i);
       any = true;
       break;
@@ -90,14 +92,15 @@ void InputHandler::mouseDown(MouseButton button)
   if (button == MouseButton::Left && _hover)
   {
     /* remove piece at hover position if present, otherwise add piece */
-    nb::Piece* p = model->piece(*_hover);
-    if (p)
-      model->remove(p);
+    nb::PieceHandle handle = model->handle(*_hover);
+    if (handle)
+      _context->history->remove(*model, handle);
     else
     {
       nb::Piece piece = *_context->brush.get();
       piece.moveAt(_hover->xy());
-      model->addPiece(_hover->z, piece);
+      if (nb::Validator::canPlace(*model, _hover->z, piece))
+        _context->history->add(*model, _hover->z, piece);
     }
   }
   else if (button == MouseButton::Right)
@@ -121,16 +124,18 @@ void InputHandler::keyDown(int key)
 {
   if (key == KEY_W)
   {
-    _context->brush->resize(_context->brush->size() + size2d_t(1, 0));
+    if (_context->brush->width() < nb::Piece::MAX_SIZE)
+      _context->brush->resize(_context->brush->size() + size2d_t(1, 0));
   }
   else if (key == KEY_Q)
   {
     if (_context->brush->width() > 1)
       _context->brush->resize(_context->brush->size() + size2d_t(-1, 0));
   }
-  else if (key == KEY_S)
+  else if (key == KEY_S && !IsKeyDown(KEY_LEFT_CONTROL) && !IsKeyDown(KEY_LEFT_SUPER))
   {
-    _context->brush->resize(_context->brush->size() + size2d_t(0, 1));
+    if (_context->brush->height() < nb::Piece::MAX_SIZE)
+      _context->brush->resize(_context->brush->size() + size2d_t(0, 1));
   }
   else if (key == KEY_A)
   {
@@ -143,15 +148,26 @@ void InputHandler::keyDown(int key)
   }
 
 
+  else if (key == KEY_Z && (IsKeyDown(KEY_LEFT_CONTROL) || IsKeyDown(KEY_LEFT_SUPER)))
+  {
+    if (IsKeyDown(KEY_LEFT_SHIFT))
+      _context->history->redo(*_context->model);
+    else
+      _context->history->undo(*_context->model);
+  }
+  else if (key == KEY_Y && (IsKeyDown(KEY_LEFT_CONTROL) || IsKeyDown(KEY_LEFT_SUPER)))
+    _context->history->redo(*_context->model);
+
+
   //TODO: check validity
   else if (key == KEY_UP)
-    _context->model->shift(Direction::North);
+    _context->history->shift(*_context->model, Direction::North);
   else if (key == KEY_RIGHT)
-    _context->model->shift(Direction::East);
+    _context->history->shift(*_context->model, Direction::East);
   else if (key == KEY_DOWN)
-    _context->model->shift(Direction::South);
+    _context->history->shift(*_context->model, Direction::South);
   else if (key == KEY_LEFT)
-    _context->model->shift(Direction::West);
+    _context->history->shift(*_context->model, Direction::West);
 
 
   else if (key >= KEY_ZERO && key <= KEY_NINE)
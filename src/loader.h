@@ -0,0 +1,31 @@
+#pragma once
+
+#include "defines.h"
+#include "model/model.h"
+#include "model/inventory.h"
+
+#include <filesystem>
+#include <future>
+#include <optional>
+
+class Loader
+{
+protected:
+  Context* _context;
+
+  /* save running on a worker thread, if any */
+  std::future<void> _pendingSave;
+
+public:
+  Loader(Context* context) : _context(context) { }
+  ~Loader() { wait(); }
+  
+  std::optional<nb::Model> load(const std::filesystem::path& filename);
+  void save(const nb::ModelSnapshot& snapshot, const std::filesystem::path& filename);
+  /* stock of parts listed by size, color, optional type and count */
+  std::optional<nb::Inventory> loadInventory(const std::filesystem::path& filename);
+  /* saves the snapshot on a worker thread while the model keeps being edited */
+  void saveInBackground(nb::ModelSnapshot snapshot, const std::filesystem::path& filename);
+  /* waits for the background save to complete */
+  void wait();
+};
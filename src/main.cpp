@@ -15,6 +15,7 @@
 #include "renderer.h"
 #include "input.h"
 #include "ui.h"
+#include "loader.h"
 
 #include <vector>
 #include <array>
@@ -23,6 +24,10 @@
 #include "model/common.h"
 #include "model/piece.h"
 #include "model/model.h"
+#include "model/validation.h"
+#include "model/history.h"
+#include "model/connectivity.h"
+#include "model/diff.h"
 
 #include "imgui.h"
 #include "imgui_internal.h"
@@ -110,6 +115,10 @@ Data::Data(Context* context) : _context(context)
     colors[id] = nb::PieceColor(id, cols);
   }
 
+  for (auto& entry : colors)
+    if (nb::Palette::global().add(&entry.second) == nb::Palette::NONE)
+      LOG("Palette is full, color %s won't be usable", entry.first.c_str());
+
   colors.lime = &colors["lime"];
   colors.white = &colors["white"];
 }
@@ -119,46 +128,42 @@ Data::Data(Context* context) : _context(context)
 
 #include "ui.h"
 
-Context::Context() :
+Context::Context(bool headless) :
   model(std::make_unique<nb::Model>()),
-  renderer(std::make_unique<gfx::Renderer>(this)),
-  input(std::make_unique<InputHandler>(this)),
+  history(std::make_unique<nb::History>()),
+  connectivity(std::make_unique<nb::Connectivity>()),
+  renderer(headless ? nullptr : std::make_unique<gfx::Renderer>(this)),
+  input(headless ? nullptr : std::make_unique<InputHandler>(this)),
   brush(std::make_unique<nb::Piece>(nb::Piece())),
-  ui(std::make_unique<UI>(this)),
+  ui(headless ? nullptr : std::make_unique<UI>(this)),
   loader(std::make_unique<Loader>(this)),
   data(std::make_unique<Data>(this))
 {
 
 }
 
-class Loader
-{
-protected:
-  Context* _context;
-public:
-  Loader(Context* context) : _context(context) { }
-  
-  std::optional<nb::Model> load(const std::filesystem::path& filename);
-  void save(const nb::Model* model, const std::filesystem::path& filename);
-};
-
-void Loader::save(const nb::Model* model, const std::filesystem::path& filename)
+void Loader::save(const nb::ModelSnapshot& snapshot, const std::filesystem::path& filename)
 {
   fkyaml::node root = { { "pieces", fkyaml::node::sequence() }, { "info", fkyaml::node::mapping() } };
-  root["info"]["name"] = model->info().name;
+  root["info"]["name"] = snapshot.info().name;
   
   auto& pieces = root["pieces"].as_seq();
 
-  for (const auto& layer : model->layers())
+  for (layer_index_t index = 0; index < snapshot.layerCount(); ++index)
   {
+    const nb::Layer* layer = snapshot.layer(index);
+
     for (const auto& piece : layer->pieces())
     {
       fkyaml::node node = {
-        { "position", fkyaml::node::sequence({ layer->index(), piece.coord().x, piece.coord().y}) },
-        { "size", fkyaml::node::sequence({ piece.width(), piece.height() }) },
-        { "color", piece.color()->ident }
+        { "position", fkyaml::node::sequence({ index, piece.coord().x + snapshot.origin().x, piece.coord().y + snapshot.origin().y}) },
+        { "size", fkyaml::node::sequence({ piece.width(), piece.height() }) }
       };
 
+      /* pieces without a color in the palette are written without one and get the default color when loaded */
+      if (piece.color())
+        node["color"] = piece.color()->ident;
+
       if (piece.type() == nb::PieceType::Round)
         node["type"] = "round";
       
@@ -174,6 +179,23 @@ void Loader::save(const nb::Model* model, const std::filesystem::path& filename)
   out.close();
 }
 
+void Loader::saveInBackground(nb::ModelSnapshot snapshot, const std::filesystem::path& filename)
+{
+  /* only one save at a time so that they can't write the same file together */
+  wait();
+
+  _pendingSave = std::async(std::launch::async, [this, snapshot = std::move(snapshot), filename]() {
+    save(snapshot, filename);
+    LOG("Saved model %s (revision %llu)", snapshot.info().name.c_str(), static_cast<unsigned long long>(snapshot.revision()));
+  });
+}
+
+void Loader::wait()
+{
+  if (_pendingSave.valid())
+    _pendingSave.get();
+}
+
 std::optional<nb::Model> Loader::load(const std::filesystem::path& file)
 {
   if (!std::filesystem::exists(file))
@@ -209,6 +231,9 @@ std::optional<nb::Model> Loader::load(const std::filesystem::path& file)
     model.info().name = node["info"]["name"].as_str();
 
     /* load pieces */
+    std::vector<nb::PieceRecord> pieces;
+    pieces.reserve(node["pieces"].as_seq().size());
+
     for (const auto& p : node["pieces"].as_seq())
     {
       int z = p["position"][0].as_int();
@@ -249,18 +274,167 @@ std::optional<nb::Model> Loader::load(const std::filesystem::path& file)
           studs = nb::StudMode::Full;
       }
 
-      model.addPiece(z, nb::Piece(coord2d_t(x, y), color, nb::PieceOrientation::North, type, size, studs));
+      /* pieces are stored with 16 bit coordinates and 8 bit sizes, the ones which don't fit are skipped */
+      if (size.width < 1 || size.height < 1 || size.width > nb::Piece::MAX_SIZE || size.height > nb::Piece::MAX_SIZE ||
+          !nb::Piece::fits(bounds2d_t(coord2d_t(x, y), coord2d_t(x + size.width, y + size.height))))
+      {
+        LOG("Piece at (%d, %d, %d) of size %dx%d is out of range, skipping it", z, x, y, size.width, size.height);
+        continue;
+      }
+
+      pieces.push_back({ z, nb::Piece(coord2d_t(x, y), color, nb::PieceOrientation::North, type, size, studs) });
     }
 
+    /* pieces which overlap a kept piece that comes earlier in the file are discarded, overlaps come in file order
+       inside each layer so the first piece of a pair is already settled when the pair is seen */
+    std::vector<bool> discarded(pieces.size(), false);
+    for (const auto& overlap : nb::Validator::validate(pieces))
+    {
+      if (discarded[overlap.first] || discarded[overlap.second])
+        continue;
+
+      const auto& a = pieces[overlap.first], &b = pieces[overlap.second];
+      LOG("Piece at (%d, %d, %d) overlaps piece at (%d, %d, %d), discarding it", b.layer, b.piece.x(), b.piece.y(), a.layer, a.piece.x(), a.piece.y());
+      discarded[overlap.second] = true;
+    }
+
+    nb::EditBatch batch;
+    batch.reserve(pieces.size());
+    for (size_t i = 0; i < pieces.size(); ++i)
+      if (!discarded[i])
+        batch.add(pieces[i].layer, pieces[i].piece);
+    model.apply(batch);
+
+    bounds2d_t bounds = model.bounds();
+    LOG("Loaded model %s (%dx%d studs, %d layers)", model.info().name.c_str(), bounds.size().width, bounds.size().height, model.layerCount());
+
     return model;
   }
 
   return std::optional<nb::Model>();
 }
 
+std::optional<nb::Inventory> Loader::loadInventory(const std::filesystem::path& file)
+{
+  if (!std::filesystem::exists(file))
+    return std::optional<nb::Inventory>();
+
+  auto node = fkyaml::node::deserialize(files::read_as_string(file));
+  if (!node.is_mapping() || !node["parts"].is_sequence())
+    return std::optional<nb::Inventory>();
+
+  nb::Inventory inventory;
+
+  for (const auto& p : node["parts"].as_seq())
+  {
+    if (!p["size"].is_sequence() || !p["color"].is_string() || !p["count"].is_integer())
+      continue;
+
+    auto color = _context->data->colors.find(p["color"].as_str());
+    if (color == _context->data->colors.end())
+    {
+      LOG("Unknown color %s in inventory, skipping part", p["color"].as_str().c_str());
+      continue;
+    }
+
+    nb::PieceType type = nb::PieceType::Square;
+    if (p["type"].is_string() && p["type"] == "round")
+      type = nb::PieceType::Round;
+
+    /* sizes are packed in 8 bits by Inventory::key like they are by pieces */
+    const size2d_t size = size2d_t(p["size"][0].as_int(), p["size"][1].as_int());
+    if (size.width < 1 || size.height < 1 || size.width > nb::Piece::MAX_SIZE || size.height > nb::Piece::MAX_SIZE || p["count"].as_int() < 0)
+    {
+      LOG("Part %dx%d of color %s is out of range, skipping it", size.width, size.height, p["color"].as_str().c_str());
+      continue;
+    }
+
+    inventory.add(size, color->second.index, type, p["count"].as_int());
+  }
+
+  LOG("Loaded inventory with %d parts", static_cast<int>(inventory.parts().size()));
+
+  return inventory;
+}
+
+static std::string describe(const nb::PieceRecord& record)
+{
+  const nb::Piece& piece = record.piece;
+  return TextFormat("%d (%d, %d) %dx%d %s", record.layer, piece.x(), piece.y(), piece.width(), piece.height(), piece.color() ? piece.color()->ident.c_str() : "none");
+}
+
+/* nanoforge diff <from> <to>
+   nanoforge merge <base> <ours> <theirs> <output> */
+static int runCommand(int arg, char* argv[])
+{
+  const std::string command = argv[1];
+
+  if (!((command == "diff" && arg == 4) || (command == "merge" && arg == 6)))
+  {
+    printf("usage: %s diff <from> <to>\n       %s merge <base> <ours> <theirs> <output>\n", argv[0], argv[0]);
+    return 2;
+  }
+
+  Context context(true);
+
+  std::vector<nb::Model> models;
+  for (int i = 2; i < (command == "diff" ? 4 : 5); ++i)
+  {
+    auto model = std::filesystem::exists(argv[i]) ? context.loader->load(argv[i]) : std::optional<nb::Model>();
+    if (!model)
+    {
+      LOG("Can't load model %s", argv[i]);
+      return 2;
+    }
+
+    models.push_back(std::move(*model));
+  }
+
+  if (command == "diff")
+  {
+    nb::Diff diff = nb::Diff::compute(models[0], models[1]);
+
+    for (const auto& entry : diff.entries)
+    {
+      switch (entry.type)
+      {
+        case nb::ChangeType::Added: printf("+ %s\n", describe(entry.to).c_str()); break;
+        case nb::ChangeType::Removed: printf("- %s\n", describe(entry.from).c_str()); break;
+        case nb::ChangeType::Moved: printf("> %s -> (%d, %d)\n", describe(entry.from).c_str(), entry.to.piece.x(), entry.to.piece.y()); break;
+        case nb::ChangeType::Recolored: printf("* %s -> %s\n", describe(entry.from).c_str(), entry.to.piece.color() ? entry.to.piece.color()->ident.c_str() : "none"); break;
+      }
+    }
+
+    LOG("%d added, %d removed, %d moved, %d recolored", static_cast<int>(diff.count(nb::ChangeType::Added)), static_cast<int>(diff.count(nb::ChangeType::Removed)),
+      static_cast<int>(diff.count(nb::ChangeType::Moved)), static_cast<int>(diff.count(nb::ChangeType::Recolored)));
+
+    return diff.entries.empty() ? 0 : 1;
+  }
+
+  nb::Merge merge = nb::Merge::compute(models[0], models[1], models[2]);
+
+  for (const auto& conflict : merge.conflicts)
+  {
+    const std::string ours = conflict.ours ? describe(*conflict.ours) : "removed";
+    const std::string theirs = conflict.theirs ? describe(*conflict.theirs) : "removed";
+
+    if (conflict.type == nb::Merge::ConflictType::Modified)
+      printf("conflict: %s changed to %s (ours) and %s (theirs), keeping ours\n", describe(*conflict.base).c_str(), ours.c_str(), theirs.c_str());
+    else
+      printf("conflict: %s (theirs) overlaps %s (ours), leaving it out\n", theirs.c_str(), ours.c_str());
+  }
+
+  context.loader->save(merge.result.snapshot(), argv[5]);
+  LOG("Merged into %s with %d conflicts", argv[5], static_cast<int>(merge.conflicts.size()));
+
+  return merge.conflicts.empty() ? 0 : 1;
+}
 
 int main(int arg, char* argv[])
 {
+  if (arg > 1)
+    return runCommand(arg, argv);
+
   SetConfigFlags(FLAG_MSAA_4X_HINT);
   InitWindow(1280, 800, "Nanoforge v0.0.1a");
 
@@ -279,8 +453,11 @@ int main(int arg, char* argv[])
 
   context.brush.reset(new nb::Piece(coord2d_t(0, 0), context.data->colors.lime, nb::PieceOrientation::North, nb::PieceType::Square, size2d_t(1, 1)));
 
-  renderer->camera().target = { gfx::Renderer::MOCK_LAYER_SIZE * side * 0.5f,  0.0f,  gfx::Renderer::MOCK_LAYER_SIZE * side * 0.5f };
-  renderer->camera().position = { renderer->camera().target.x * 4.0f, renderer->camera().target.x * 2.0f, renderer->camera().target.y * 4.0f };
+  /* frame the whole model */
+  bounds2d_t area = renderer->_topDown.area();
+  float extent = std::max(area.size().width, area.size().height) * side * 0.5f;
+  renderer->camera().target = { (area.min.x + area.max.x) * side * 0.5f,  0.0f,  (area.min.y + area.max.y) * side * 0.5f };
+  renderer->camera().position = { renderer->camera().target.x + extent * 3.0f, extent * 2.0f, renderer->camera().target.z - extent };
   renderer->camera().up = { 0.0f,  1.0f,  0.0f };
   renderer->camera().fovy = 45.0f;
   renderer->camera().projection = CAMERA_PERSPECTIVE;
@@ -292,6 +469,8 @@ int main(int arg, char* argv[])
 
   while (!WindowShouldClose())
   {
+    context.connectivity->update(*model);
+
     BeginDrawing();
     ClearBackground(RAYWHITE);
 
@@ -321,11 +500,18 @@ int main(int arg, char* argv[])
       auto idx = it.index();
       if (idx >= 0)
       {
-        float y = (gfx::Renderer::MOCK_LAYER_SIZE * Data::Constants::LAYER2D_CELL_SIZE.height) * it.relative() + (Data::Constants::LAYER2D_SPACING * it.relative());
-        renderer->renderLayerGrid2d(context.prefs.gridTopPosition() + vec2(0, y), model->layer(idx), size2d_t(gfx::Renderer::MOCK_LAYER_SIZE, gfx::Renderer::MOCK_LAYER_SIZE), Data::Constants::LAYER2D_CELL_SIZE);
+        rect bounds = renderer->_topDown.screenBounds(it.relative());
+        renderer->renderLayerGrid2d(bounds.Origin(), idx, renderer->_topDown.area(), Data::Constants::LAYER2D_CELL_SIZE);
       }
     }
 
+    /* frame counters, instances drawn and pieces culled are expected to match the pieces of the model and nothing is uploaded while it doesn't change */
+    const auto& stats = renderer->stats();
+    DrawText(TextFormat("Pieces: %d, instances: %d, studs: %d, culled: %d pieces %d studs, draw calls: %d, uploaded: %d bytes, edges: %s, frame: %.2f ms", static_cast<int>(stats.pieces),
+      static_cast<int>(stats.instances), static_cast<int>(stats.studs), static_cast<int>(stats.culledPieces), static_cast<int>(stats.culledStuds), static_cast<int>(stats.drawCalls),
+      static_cast<int>(stats.uploadedBytes), renderer->edgeMode() == gfx::Renderer::EdgeMode::Geometry ? "geometry" : "screen space", GetFrameTime() * 1000.0f),
+      10, GetScreenHeight() - 50, 14, stats.instances + stats.culledPieces == stats.pieces ? DARKGRAY : RED);
+
     if (input->hover())
     {
       /* draw string with coordinate in bottom left corner */
@@ -353,7 +539,8 @@ int main(int arg, char* argv[])
 
   renderer->deinit();
 
-  context.loader->save(model.get(), context.prefs.basePath + "/model.yml");
+  context.loader->wait();
+  context.loader->save(model->snapshot(), context.prefs.basePath + "/model.yml");
 
   CloseWindow();
   return 0;
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "piece.h"
+
+#include <vector>
+
+namespace nb
+{
+  /* collects a group of edits which are applied to a model all together by Model::apply,
+     derived data (occupancy, bounds, revision) is then updated once per batch instead of once per piece */
+  class EditBatch
+  {
+  protected:
+    struct Insertion
+    {
+      layer_index_t layer;
+      Piece piece;
+    };
+
+    struct Movement
+    {
+      PieceHandle handle;
+      coord2d_t delta;
+    };
+
+    std::vector<Insertion> _insertions;
+    std::vector<PieceHandle> _removals;
+    std::vector<Movement> _movements;
+
+  public:
+    void add(layer_index_t layer, const Piece& piece) { _insertions.push_back({ layer, piece }); }
+    void remove(PieceHandle handle) { _removals.push_back(handle); }
+    void move(PieceHandle handle, coord2d_t delta) { _movements.push_back({ handle, delta }); }
+
+    void reserve(size_t count) { _insertions.reserve(count); }
+    void clear() { _insertions.clear(); _removals.clear(); _movements.clear(); }
+
+    size_t size() const { return _insertions.size() + _removals.size() + _movements.size(); }
+    bool empty() const { return size() == 0; }
+
+    friend class Model;
+    friend class History;
+  };
+}
@@ -0,0 +1,267 @@
+#include "brickify.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <future>
+#include <thread>
+
+using namespace nb;
+
+/* rows of bits have room for one more column than the volume so that seams on the right side of the last column fit */
+static size_t wordsPerRow(coord_t width) { return size_t(width) / 64 + 1; }
+
+static bool test(const uint64_t* row, coord_t x) { return (row[x >> 6] >> (x & 63)) & 1; }
+static void set(uint64_t* row, coord_t x) { row[x >> 6] |= uint64_t(1) << (x & 63); }
+
+/* true if all the bits in [x, x + length) are set */
+static bool spanSet(const uint64_t* row, coord_t x, coord_t length)
+{
+  while (length > 0)
+  {
+    const coord_t bit = x & 63, count = std::min<coord_t>(length, 64 - bit);
+    const uint64_t mask = (count == 64 ? ~uint64_t(0) : ((uint64_t(1) << count) - 1)) << bit;
+
+    if ((row[x >> 6] & mask) != mask)
+      return false;
+
+    x += count;
+    length -= count;
+  }
+
+  return true;
+}
+
+static void clearSpan(uint64_t* row, coord_t x, coord_t length)
+{
+  while (length > 0)
+  {
+    const coord_t bit = x & 63, count = std::min<coord_t>(length, 64 - bit);
+    row[x >> 6] &= ~((count == 64 ? ~uint64_t(0) : ((uint64_t(1) << count) - 1)) << bit);
+
+    x += count;
+    length -= count;
+  }
+}
+
+nb::Brickifier::Brickifier(const std::vector<size2d_t>& catalog)
+{
+  _catalog.push_back(size2d_t(1, 1));
+
+  for (const size2d_t& size : catalog)
+  {
+    if (size.width < 1 || size.height < 1 || size.width > Piece::MAX_SIZE || size.height > Piece::MAX_SIZE)
+      continue;
+
+    _catalog.push_back(size);
+    _catalog.push_back(size2d_t(size.height, size.width));
+  }
+
+  std::sort(_catalog.begin(), _catalog.end(), [](const size2d_t& a, const size2d_t& b) {
+    return a.width * a.height != b.width * b.height ? a.width * a.height > b.width * b.height : a.width > b.width;
+  });
+
+  _catalog.erase(std::unique(_catalog.begin(), _catalog.end(), [](const size2d_t& a, const size2d_t& b) {
+    return a.width == b.width && a.height == b.height;
+  }), _catalog.end());
+}
+
+std::vector<size2d_t> nb::Brickifier::defaultCatalog()
+{
+  return {
+    size2d_t(1, 2), size2d_t(1, 3), size2d_t(1, 4), size2d_t(1, 6), size2d_t(1, 8),
+    size2d_t(2, 2), size2d_t(2, 3), size2d_t(2, 4), size2d_t(2, 6), size2d_t(2, 8)
+  };
+}
+
+void nb::Brickifier::brickifyLayer(const VoxelVolume& volume, layer_index_t z, std::vector<LayerResult>& results) const
+{
+  const coord_t width = volume.size().width, height = volume.size().height;
+  const size_t words = wordsPerRow(width);
+
+  LayerResult& result = results[z];
+  result.seamsX.assign(height * words, 0);
+  result.seamsY.assign((height + 1) * words, 0);
+
+  /* cells still to be covered and how many cells of the same color follow each cell on its row */
+  std::vector<uint64_t> free(height * words, 0);
+  std::vector<uint16_t> run(size_t(width) * height, 0);
+
+  for (coord_t y = 0; y < height; ++y)
+  {
+    for (coord_t x = width - 1; x >= 0; --x)
+    {
+      const palette_index_t color = volume.at(x, y, z);
+      if (color == Palette::NONE)
+        continue;
+
+      set(&free[y * words], x);
+      const uint16_t next = (x + 1 < width && volume.at(x + 1, y, z) == color) ? run[y * width + x + 1] : 0;
+      run[y * width + x] = next < 0xFFFF ? next + 1 : next;
+    }
+  }
+
+  /* even layers are laid out first, odd ones then look at the layers on both sides */
+  const LayerResult* adjacent[2];
+  layer_index_t adjacentZ[2];
+  size_t adjacentCount = 0;
+
+  if (z & 1)
+  {
+    for (layer_index_t other : { z - 1, z + 1 })
+    {
+      if (other >= 0 && other < volume.layerCount())
+      {
+        adjacent[adjacentCount] = &results[other];
+        adjacentZ[adjacentCount++] = other;
+      }
+    }
+  }
+
+  auto fits = [&](coord_t x, coord_t y, size2d_t size, palette_index_t color) {
+    if (x + size.width > width || y + size.height > height)
+      return false;
+
+    for (coord_t r = y; r < y + size.height; ++r)
+      if (volume.at(x, r, z) != color || run[r * width + x] < size.width || !spanSet(&free[r * words], x, size.width))
+        return false;
+
+    return true;
+  };
+
+  /* fraction of the right and bottom joints of a brick which lie over joints of adjacent layers */
+  auto alignment = [&](coord_t x, coord_t y, size2d_t size) {
+    size_t joints = 0, aligned = 0;
+
+    for (coord_t r = y; r < y + size.height; ++r)
+    {
+      const coord_t c = x + size.width;
+      if (!volume.occupied(c, r, z))
+        continue;
+
+      ++joints;
+      for (size_t i = 0; i < adjacentCount; ++i)
+        if (test(&adjacent[i]->seamsX[r * words], c) && volume.occupied(c - 1, r, adjacentZ[i]) && volume.occupied(c, r, adjacentZ[i]))
+          ++aligned;
+    }
+
+    for (coord_t c = x; c < x + size.width; ++c)
+    {
+      const coord_t r = y + size.height;
+      if (!volume.occupied(c, r, z))
+        continue;
+
+      ++joints;
+      for (size_t i = 0; i < adjacentCount; ++i)
+        if (test(&adjacent[i]->seamsY[r * words], c) && volume.occupied(c, r - 1, adjacentZ[i]) && volume.occupied(c, r, adjacentZ[i]))
+          ++aligned;
+    }
+
+    return joints ? float(aligned) / float(joints * adjacentCount) : 0.0f;
+  };
+
+  /* bricks run along x on even layers and along y on odd ones when nothing else tells them apart */
+  const bool preferVertical = z & 1;
+  auto preferred = [preferVertical](size2d_t size) { return preferVertical ? size.height > size.width : size.width > size.height; };
+
+  for (coord_t y = 0; y < height; ++y)
+  {
+    for (size_t i = 0; i < words; ++i)
+    {
+      uint64_t bits;
+      while ((bits = free[y * words + i]))
+      {
+        const coord_t x = coord_t(i * 64 + std::countr_zero(bits));
+        const palette_index_t color = volume.at(x, y, z);
+
+        size2d_t best = size2d_t(1, 1);
+        float bestScore = 0.0f;
+
+        for (const size2d_t& size : _catalog)
+        {
+          const float area = float(size.width * size.height);
+
+          /* score never exceeds the area and sizes come by decreasing area */
+          if (area < bestScore)
+            break;
+
+          if (!fits(x, y, size, color))
+            continue;
+
+          /* a brick whose joints all lie over other joints is worth half of its area */
+          const float score = adjacentCount ? area * (1.0f - alignment(x, y, size) * 0.5f) : area;
+
+          if (score > bestScore || (score == bestScore && preferred(size) && !preferred(best)))
+          {
+            best = size;
+            bestScore = score;
+          }
+        }
+
+        for (coord_t r = y; r < y + best.height; ++r)
+        {
+          clearSpan(&free[r * words], x, best.width);
+          set(&result.seamsX[r * words], x);
+          set(&result.seamsX[r * words], x + best.width);
+        }
+
+        for (coord_t c = x; c < x + best.width; ++c)
+        {
+          set(&result.seamsY[y * words], c);
+          set(&result.seamsY[(y + best.height) * words], c);
+        }
+
+        result.bricks.push_back(Piece(coord2d_t(x, y), Palette::global()[color], PieceOrientation::North, PieceType::Square, best, StudMode::Full));
+      }
+    }
+  }
+}
+
+std::vector<PieceRecord> nb::Brickifier::brickify(const VoxelVolume& volume) const
+{
+  std::vector<LayerResult> results(volume.layerCount());
+
+  const size_t cells = size_t(volume.size().width) * volume.size().height * volume.layerCount();
+  if (cells < PARALLEL_CELLS)
+  {
+    for (layer_index_t parity = 0; parity < 2; ++parity)
+      for (layer_index_t z = parity; z < volume.layerCount(); z += 2)
+        brickifyLayer(volume, z, results);
+  }
+  else
+  {
+    /* layers of the same parity don't depend on each other so each group is split among all the cores */
+    const size_t threads = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), volume.layerCount() / 2 + 1));
+
+    for (layer_index_t parity = 0; parity < 2; ++parity)
+    {
+      std::atomic<layer_index_t> next = parity;
+      std::vector<std::future<void>> workers;
+
+      for (size_t i = 0; i < threads; ++i)
+      {
+        workers.push_back(std::async(std::launch::async, [this, &volume, &results, &next]() {
+          layer_index_t z;
+          while ((z = next.fetch_add(2)) < volume.layerCount())
+            brickifyLayer(volume, z, results);
+        }));
+      }
+
+      for (auto& worker : workers)
+        worker.get();
+    }
+  }
+
+  size_t count = 0;
+  for (const LayerResult& result : results)
+    count += result.bricks.size();
+
+  std::vector<PieceRecord> records;
+  records.reserve(count);
+
+  for (layer_index_t z = 0; z < volume.layerCount(); ++z)
+    for (const Piece& brick : results[z].bricks)
+      records.push_back({ z, brick });
+
+  return records;
+}
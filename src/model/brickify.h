@@ -0,0 +1,63 @@
+#pragma once
+
+#include "piece.h"
+
+#include <vector>
+
+namespace nb
+{
+  /* per stud occupancy of a stack of layers, each cell holds the palette index of its color or Palette::NONE if empty */
+  class VoxelVolume
+  {
+  protected:
+    size2d_t _size;
+    layer_index_t _layers;
+    std::vector<palette_index_t> _cells;
+
+  public:
+    VoxelVolume(size2d_t size, layer_index_t layers) : _size(size), _layers(layers), _cells(size_t(size.width) * size.height * layers, Palette::NONE) { }
+
+    palette_index_t at(coord_t x, coord_t y, layer_index_t z) const { return _cells[(size_t(z) * _size.height + y) * _size.width + x]; }
+    void set(coord_t x, coord_t y, layer_index_t z, palette_index_t color) { _cells[(size_t(z) * _size.height + y) * _size.width + x] = color; }
+
+    bool occupied(coord_t x, coord_t y, layer_index_t z) const
+    {
+      return x >= 0 && y >= 0 && x < _size.width && y < _size.height && z >= 0 && z < _layers && at(x, y, z) != Palette::NONE;
+    }
+
+    size2d_t size() const { return _size; }
+    layer_index_t layerCount() const { return _layers; }
+  };
+
+  /* turns a voxel volume into bricks from a catalog of sizes, every layer is covered greedily with the largest brick
+     of a single color which fits at the first free cell, odd layers then avoid seams lying over seams of the layers
+     next to them so that bricks bind across joints */
+  class Brickifier
+  {
+  protected:
+    /* bricks of a layer together with the seams between them, one bit per cell for the boundary on its left and top side */
+    struct LayerResult
+    {
+      std::vector<Piece> bricks;
+      std::vector<uint64_t> seamsX;
+      std::vector<uint64_t> seamsY;
+    };
+
+    /* both orientations of every size, sorted by decreasing area */
+    std::vector<size2d_t> _catalog;
+
+    void brickifyLayer(const VoxelVolume& volume, layer_index_t z, std::vector<LayerResult>& results) const;
+
+  public:
+    /* volumes with fewer cells are brickified on the calling thread, starting workers would cost more than the work */
+    static constexpr size_t PARALLEL_CELLS = 1 << 16;
+
+    /* 1x1 is always part of the catalog so that any volume can be covered */
+    Brickifier(const std::vector<size2d_t>& catalog = defaultCatalog());
+
+    static std::vector<size2d_t> defaultCatalog();
+
+    /* bricks covering the volume, their coordinates are relative to the corner of the volume */
+    std::vector<PieceRecord> brickify(const VoxelVolume& volume) const;
+  };
+}
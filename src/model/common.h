@@ -2,8 +2,11 @@
 
 #include <cstdint>
 #include <string>
+#include <limits>
+#include <algorithm>
 
 using layer_index_t = int32_t;
+using layer_id_t = uint32_t;
 using coord_t = int32_t;
 
 enum class Direction { North, East, South, West };
@@ -39,3 +42,55 @@ struct size2d_t
   
   size2d_t operator+(const size2d_t& size) const { return size2d_t(width + size.width, height + size.height); }
 };
+
+/* axis aligned rectangle of cells, min is inclusive while max is exclusive */
+struct bounds2d_t
+{
+  coord2d_t min;
+  coord2d_t max;
+
+  bounds2d_t() : min(std::numeric_limits<coord_t>::max(), std::numeric_limits<coord_t>::max()), max(std::numeric_limits<coord_t>::min(), std::numeric_limits<coord_t>::min()) { }
+  bounds2d_t(coord2d_t min, coord2d_t max) : min(min), max(max) { }
+
+  bool empty() const { return min.x >= max.x || min.y >= max.y; }
+  size2d_t size() const { return empty() ? size2d_t(0, 0) : size2d_t(max.x - min.x, max.y - min.y); }
+
+  bool contains(const coord2d_t& c) const { return c.x >= min.x && c.x < max.x && c.y >= min.y && c.y < max.y; }
+  bool intersects(const bounds2d_t& o) const { return min.x < o.max.x && o.min.x < max.x && min.y < o.max.y && o.min.y < max.y; }
+  bounds2d_t intersection(const bounds2d_t& o) const { return bounds2d_t(coord2d_t(std::max(min.x, o.min.x), std::max(min.y, o.min.y)), coord2d_t(std::min(max.x, o.max.x), std::min(max.y, o.max.y))); }
+  /* true if any side of inner lies on a side of this */
+  bool touchesEdge(const bounds2d_t& inner) const { return inner.min.x == min.x || inner.min.y == min.y || inner.max.x == max.x || inner.max.y == max.y; }
+
+  bounds2d_t translated(const coord2d_t& delta) const { return empty() ? *this : bounds2d_t(min + delta, max + delta); }
+  bounds2d_t expanded(coord_t margin) const { return empty() ? *this : bounds2d_t(min + coord2d_t(-margin, -margin), max + coord2d_t(margin, margin)); }
+
+  void merge(const bounds2d_t& o)
+  {
+    if (o.empty())
+      return;
+
+    min = coord2d_t(std::min(min.x, o.min.x), std::min(min.y, o.min.y));
+    max = coord2d_t(std::max(max.x, o.max.x), std::max(max.y, o.max.y));
+  }
+};
+
+/* box of cells spanning a range of layers, bottom layer is inclusive while top is exclusive */
+struct bounds3d_t
+{
+  bounds2d_t area;
+  layer_index_t bottom;
+  layer_index_t top;
+
+  bounds3d_t(const bounds2d_t& area, layer_index_t bottom, layer_index_t top) : area(area), bottom(bottom), top(top) { }
+
+  bool empty() const { return area.empty() || bottom >= top; }
+  bool contains(const coord3d_t& c) const { return c.z >= bottom && c.z < top && area.contains(c.xy()); }
+};
+
+#if defined(__AVX2__)
+  #define NB_SIMD_AVX2
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define NB_SIMD_SSE2
+#endif
@@ -0,0 +1,344 @@
+#include "connectivity.h"
+
+#include "model.h"
+
+#include <algorithm>
+#include <numeric>
+
+using namespace nb;
+
+/* true if the studs of lower hold upper, pieces are assumed to overlap */
+static bool grips(const Piece& lower, const Piece& upper)
+{
+  switch (lower.studs())
+  {
+    case StudMode::None:
+      return false;
+    case StudMode::Centered:
+      return upper.bounds().contains(coord2d_t(lower.x() + lower.width() / 2, lower.y() + lower.height() / 2));
+    default:
+      return true;
+  }
+}
+
+template<typename F>
+void nb::Connectivity::forEachContact(const Model& model, layer_index_t position, const Piece& piece, bool above, F&& f)
+{
+  const bounds2d_t area = piece.bounds();
+
+  for (layer_index_t other = position - 1; other <= position + (above ? 1 : -1); other += 2)
+  {
+    const Layer* layer = model.layer(other);
+    if (!layer)
+      continue;
+
+    layer->query(area, [&](size_t index) {
+      const Piece candidate = layer->_pieces[index];
+      if (other < position ? grips(candidate, piece) : grips(piece, candidate))
+        f(layer->_slots[index]);
+    });
+  }
+}
+
+uint32_t nb::Connectivity::find(uint32_t node) const
+{
+  while (_parent[node] != node)
+  {
+    _parent[node] = _parent[_parent[node]];
+    node = _parent[node];
+  }
+
+  return node;
+}
+
+uint32_t nb::Connectivity::makeNode(uint32_t size, uint32_t grounded)
+{
+  uint32_t node = static_cast<uint32_t>(_parent.size());
+  _parent.push_back(node);
+  _size.push_back(size);
+  _groundedCount.push_back(grounded);
+  return node;
+}
+
+void nb::Connectivity::unite(uint32_t a, uint32_t b)
+{
+  a = find(a);
+  b = find(b);
+
+  if (a == b)
+    return;
+
+  if (_size[a] < _size[b])
+    std::swap(a, b);
+
+  _parent[b] = a;
+  _size[a] += _size[b];
+  _groundedCount[a] += _groundedCount[b];
+}
+
+void nb::Connectivity::connect(uint32_t a, uint32_t b)
+{
+  _adjacent[a].push_back(b);
+  _adjacent[b].push_back(a);
+  unite(_node[a], _node[b]);
+}
+
+void nb::Connectivity::resize(size_t slots)
+{
+  if (_node.size() < slots)
+  {
+    _node.resize(slots, NONE);
+    _adjacent.resize(slots);
+    _grounded.resize(slots, 0);
+    _visitedBy.resize(slots, 0);
+    _visitEpoch.resize(slots, 0);
+  }
+}
+
+void nb::Connectivity::add(const Model& model, uint32_t slot)
+{
+  const auto& entry = model._slots[slot];
+  const Piece piece = model._layers[entry.layer]->_pieces[entry.index];
+  const layer_index_t position = model.position(entry.layer);
+
+  _grounded[slot] = position == 0;
+  _node[slot] = makeNode(1, _grounded[slot]);
+  ++_pieces;
+
+  /* pieces not tracked yet will connect to this one when they're added themselves */
+  forEachContact(model, position, piece, true, [this, slot](uint32_t other) {
+    if (_node[other] != NONE)
+      connect(slot, other);
+  });
+}
+
+void nb::Connectivity::remove(uint32_t slot)
+{
+  const uint32_t root = find(_node[slot]);
+  --_size[root];
+  _groundedCount[root] -= _grounded[slot];
+
+  std::vector<uint32_t> neighbours = std::move(_adjacent[slot]);
+  _adjacent[slot].clear();
+
+  for (uint32_t other : neighbours)
+  {
+    auto& list = _adjacent[other];
+    auto it = std::find(list.begin(), list.end(), slot);
+    *it = list.back();
+    list.pop_back();
+  }
+
+  _node[slot] = NONE;
+  --_pieces;
+
+  if (neighbours.size() > 1)
+    split(neighbours);
+}
+
+void nb::Connectivity::split(const std::vector<uint32_t>& neighbours)
+{
+  const size_t count = neighbours.size();
+
+  if (++_epoch == 0)
+  {
+    std::fill(_visitEpoch.begin(), _visitEpoch.end(), 0);
+    _epoch = 1;
+  }
+
+  /* one breadth first search per neighbour, visited lists double as queues, searches that meet join a group */
+  std::vector<std::vector<uint32_t>> visited(count);
+  std::vector<size_t> head(count, 0);
+  std::vector<uint32_t> group(count);
+  std::iota(group.begin(), group.end(), 0);
+
+  auto groupOf = [&group](uint32_t i) {
+    while (group[i] != i)
+      i = group[i] = group[group[i]];
+    return i;
+  };
+
+  auto visit = [&](uint32_t search, uint32_t slot) {
+    if (_visitEpoch[slot] == _epoch)
+      group[groupOf(_visitedBy[slot])] = groupOf(search);
+    else
+    {
+      _visitEpoch[slot] = _epoch;
+      _visitedBy[slot] = search;
+      visited[search].push_back(slot);
+    }
+  };
+
+  for (uint32_t i = 0; i < count; ++i)
+    visit(i, neighbours[i]);
+
+  std::vector<uint8_t> active(count);
+
+  while (true)
+  {
+    /* a group is done once all of its searches ran out of pieces, its component is then complete */
+    std::fill(active.begin(), active.end(), 0);
+    size_t groups = 0, activeGroups = 0;
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+      if (groupOf(i) == i)
+        ++groups;
+      if (head[i] < visited[i].size())
+        active[groupOf(i)] = 1;
+    }
+
+    for (uint32_t i = 0; i < count; ++i)
+      activeGroups += active[i];
+
+    /* all searches met, component is still whole */
+    if (groups == 1)
+      return;
+    else if (activeGroups <= 1)
+      break;
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+      if (head[i] < visited[i].size())
+      {
+        uint32_t slot = visited[i][head[i]++];
+        for (uint32_t other : _adjacent[slot])
+          visit(i, other);
+      }
+    }
+  }
+
+  /* every finished group but one becomes a component of its own, the one still searching or else
+     the largest keeps the old root since its pieces may be anywhere on its paths */
+  std::vector<uint32_t> members(count, 0);
+  for (uint32_t i = 0; i < count; ++i)
+    members[groupOf(i)] += static_cast<uint32_t>(visited[i].size());
+
+  uint32_t keep = NONE;
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    if (groupOf(i) == i && (active[i] || (keep != NONE && !active[keep] && members[i] > members[keep]) || keep == NONE))
+      keep = i;
+  }
+
+  const uint32_t root = find(_node[neighbours[0]]);
+  std::vector<uint32_t> nodes(count, NONE);
+
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    const uint32_t g = groupOf(i);
+    if (g == keep)
+      continue;
+
+    if (nodes[g] == NONE)
+      nodes[g] = makeNode(0, 0);
+
+    for (uint32_t slot : visited[i])
+    {
+      _node[slot] = nodes[g];
+      ++_size[nodes[g]];
+      _groundedCount[nodes[g]] += _grounded[slot];
+      --_size[root];
+      _groundedCount[root] -= _grounded[slot];
+    }
+  }
+}
+
+void nb::Connectivity::rebuild(const Model& model)
+{
+  _node.clear();
+  _adjacent.clear();
+  _grounded.clear();
+  _parent.clear();
+  _size.clear();
+  _groundedCount.clear();
+  _visitedBy.clear();
+  _visitEpoch.clear();
+  _epoch = 0;
+  _pieces = 0;
+
+  resize(model._slots.size());
+
+  model.eachLayer([this](layer_index_t position, const Layer* layer) {
+    for (size_t i = 0; i < layer->_pieces.size(); ++i)
+    {
+      const uint32_t slot = layer->_slots[i];
+      _grounded[slot] = position == 0;
+      _node[slot] = makeNode(1, _grounded[slot]);
+      ++_pieces;
+    }
+  });
+
+  /* every contact is found once from the upper piece */
+  model.eachLayer([this, &model](layer_index_t position, const Layer* layer) {
+    for (size_t i = 0; i < layer->_pieces.size(); ++i)
+    {
+      const uint32_t slot = layer->_slots[i];
+      forEachContact(model, position, layer->_pieces[i], false, [this, slot](uint32_t other) { connect(slot, other); });
+    }
+  });
+
+  _journal = model.journal().id();
+  _cursor = model.journal().version();
+  _synced = true;
+}
+
+void nb::Connectivity::update(const Model& model)
+{
+  if (!_synced || _journal != model.journal().id() || !model.journal().available(_cursor))
+  {
+    rebuild(model);
+    return;
+  }
+
+  std::vector<uint32_t> touched;
+  model.journal().read(_cursor, [&touched](const Change& change) {
+    if (change.type != ChangeType::Recolored)
+      touched.push_back(change.handle.index);
+  });
+
+  if (touched.empty())
+    return;
+
+  std::sort(touched.begin(), touched.end());
+  touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+
+  if (touched.size() * REBUILD_RATIO > _pieces && touched.size() > 64)
+  {
+    rebuild(model);
+    return;
+  }
+
+  resize(model._slots.size());
+
+  /* pieces which changed are taken out and put back as they are now */
+  for (uint32_t slot : touched)
+    if (_node[slot] != NONE)
+      remove(slot);
+
+  for (uint32_t slot : touched)
+    if (model._slots[slot].layer != Model::NO_LAYER)
+      add(model, slot);
+
+  /* nodes left behind by splits are dropped once they outnumber pieces */
+  if (_parent.size() > 4 * _pieces + 1024)
+    rebuild(model);
+}
+
+bool nb::Connectivity::floating(const Layer* layer, size_t index) const
+{
+  const uint32_t slot = layer->_slots[index];
+  if (slot >= _node.size() || _node[slot] == NONE)
+    return false;
+
+  return _groundedCount[find(_node[slot])] == 0;
+}
+
+bool nb::Connectivity::floating(const Model& model, PieceHandle handle) const
+{
+  if (!model.valid(handle))
+    return false;
+
+  const auto& entry = model._slots[handle.index];
+  return floating(model._layers[entry.layer].get(), entry.index);
+}
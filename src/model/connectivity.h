@@ -0,0 +1,70 @@
+#pragma once
+
+#include "piece.h"
+
+#include <vector>
+
+namespace nb
+{
+  class Model;
+  class Layer;
+
+  /* tracks which pieces hold together through the studs of a piece gripping the underside of the one above,
+     components live in a union-find fed by the model journal so additions only merge sets, a removal splits
+     a component only after searches started from the neighbours of the removed piece fail to meet */
+  class Connectivity
+  {
+  public:
+    static constexpr uint32_t NONE = ~uint32_t(0);
+    /* edits touching more than 1/REBUILD_RATIO of the tracked pieces cause a full rebuild instead */
+    static constexpr size_t REBUILD_RATIO = 8;
+
+  protected:
+    /* per piece slot: union-find node, pieces in contact and whether the piece rests on the bottom layer */
+    std::vector<uint32_t> _node;
+    std::vector<std::vector<uint32_t>> _adjacent;
+    std::vector<uint8_t> _grounded;
+
+    /* union-find nodes, pieces split away from a component get new nodes while the old ones
+       can stay as inner nodes of the paths of the pieces left behind */
+    mutable std::vector<uint32_t> _parent;
+    std::vector<uint32_t> _size;
+    std::vector<uint32_t> _groundedCount;
+
+    size_t _pieces;
+    /* id of the journal the cursor belongs to, a model loaded in place of another one has a new journal */
+    uint64_t _journal;
+    uint64_t _cursor;
+    bool _synced;
+
+    /* scratch state of split searches */
+    std::vector<uint32_t> _visitedBy;
+    std::vector<uint32_t> _visitEpoch;
+    uint32_t _epoch;
+
+    uint32_t find(uint32_t node) const;
+    uint32_t makeNode(uint32_t size, uint32_t grounded);
+    void unite(uint32_t a, uint32_t b);
+    void connect(uint32_t a, uint32_t b);
+
+    void add(const Model& model, uint32_t slot);
+    void remove(uint32_t slot);
+    void split(const std::vector<uint32_t>& neighbours);
+    void rebuild(const Model& model);
+    void resize(size_t slots);
+
+    /* calls f(slot) for every piece of the adjacent layers in contact with piece, each one exactly once */
+    template<typename F> static void forEachContact(const Model& model, layer_index_t position, const Piece& piece, bool above, F&& f);
+
+  public:
+    Connectivity() : _pieces(0), _journal(0), _cursor(0), _synced(false), _epoch(0) { }
+
+    /* catches up with the edits recorded in the model journal */
+    void update(const Model& model);
+    void reset() { _synced = false; }
+
+    /* true if the piece isn't connected, directly or through other pieces, to the bottom layer */
+    bool floating(const Layer* layer, size_t index) const;
+    bool floating(const Model& model, PieceHandle handle) const;
+  };
+}
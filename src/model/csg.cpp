@@ -0,0 +1,176 @@
+#include "csg.h"
+
+#include "model.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+using namespace nb;
+
+struct CutCell
+{
+  layer_index_t layer;
+  coord2d_t coord;
+  palette_index_t color;
+};
+
+/* adds to batch the pieces of source inside or outside of mask, cells left from cut pieces go to cells */
+static void clip(const nb::Model& source, const nb::Model& mask, bool inside, EditBatch& batch, std::vector<CutCell>& cells)
+{
+  source.eachLayer([&](layer_index_t position, const Layer* layer) {
+    const Layer* other = mask.layer(position);
+    const coord2d_t toMask = coord2d_t(source.origin().x - mask.origin().x, source.origin().y - mask.origin().y);
+
+    for (Piece piece : layer->pieces())
+    {
+      const size_t area = size_t(piece.width()) * piece.height();
+      const size_t covered = other ? other->occupancy().count(piece.bounds().translated(toMask)) : 0;
+
+      piece.moveBy(source.origin());
+
+      if (covered == (inside ? area : 0))
+        batch.add(position, piece);
+      else if (covered != (inside ? 0 : area))
+      {
+        const OccupancyIndex& occupancy = other->occupancy();
+
+        for (coord_t y = piece.y(); y < piece.y() + piece.height(); ++y)
+          for (coord_t x = piece.x(); x < piece.x() + piece.width(); ++x)
+            if ((occupancy.at(coord2d_t(x - mask.origin().x, y - mask.origin().y)) != OccupancyIndex::INVALID) == inside)
+              cells.push_back({ position, coord2d_t(x, y), piece.colorIndex() });
+      }
+    }
+  });
+}
+
+/* cells keep 16 bit coordinates like the pieces they come from, which packs a cell in a single key */
+static uint64_t cellKey(layer_index_t layer, coord_t x, coord_t y)
+{
+  return (uint64_t(uint16_t(layer)) << 32) | (uint64_t(uint16_t(x)) << 16) | uint16_t(y);
+}
+
+/* brickifies the cells of a connected region into a volume spanning just them and adds the bricks to batch */
+static void rebuildRegion(const std::vector<CutCell>& cells, const std::vector<size_t>& region, const Brickifier& brickifier, EditBatch& batch)
+{
+  bounds2d_t area;
+  layer_index_t bottom = cells[region.front()].layer, top = bottom;
+
+  for (size_t index : region)
+  {
+    const CutCell& cell = cells[index];
+    area.merge(bounds2d_t(cell.coord, cell.coord + coord2d_t(1, 1)));
+    bottom = std::min(bottom, cell.layer);
+    top = std::max(top, cell.layer);
+  }
+
+  VoxelVolume volume(area.size(), top - bottom + 1);
+  for (size_t index : region)
+  {
+    const CutCell& cell = cells[index];
+    volume.set(cell.coord.x - area.min.x, cell.coord.y - area.min.y, cell.layer - bottom, cell.color);
+  }
+
+  for (PieceRecord& record : brickifier.brickify(volume))
+  {
+    record.piece.moveBy(area.min);
+    batch.add(record.layer + bottom, record.piece);
+  }
+}
+
+/* brickifies the cells left from cut pieces, cells are split in regions connected through their sides or through the
+   layers above and below so that far apart cuts don't end up sharing a volume spanning all of them */
+static void rebuild(const std::vector<CutCell>& cells, const Brickifier& brickifier, EditBatch& batch)
+{
+  std::unordered_map<uint64_t, size_t> lookup;
+  lookup.reserve(cells.size());
+  for (size_t i = 0; i < cells.size(); ++i)
+    lookup.emplace(cellKey(cells[i].layer, cells[i].coord.x, cells[i].coord.y), i);
+
+  std::vector<bool> visited(cells.size(), false);
+  std::vector<size_t> region, pending;
+
+  for (size_t i = 0; i < cells.size(); ++i)
+  {
+    if (visited[i])
+      continue;
+
+    region.clear();
+    pending.push_back(i);
+    visited[i] = true;
+
+    while (!pending.empty())
+    {
+      const size_t index = pending.back();
+      pending.pop_back();
+      region.push_back(index);
+
+      const CutCell& cell = cells[index];
+      const coord3d_t neighbours[] = {
+        coord3d_t(cell.coord + coord2d_t(-1, 0), cell.layer), coord3d_t(cell.coord + coord2d_t(1, 0), cell.layer),
+        coord3d_t(cell.coord + coord2d_t(0, -1), cell.layer), coord3d_t(cell.coord + coord2d_t(0, 1), cell.layer),
+        coord3d_t(cell.coord, cell.layer - 1), coord3d_t(cell.coord, cell.layer + 1)
+      };
+
+      for (const coord3d_t& neighbour : neighbours)
+      {
+        auto it = lookup.find(cellKey(neighbour.z, neighbour.x, neighbour.y));
+        if (it != lookup.end() && !visited[it->second])
+        {
+          visited[it->second] = true;
+          pending.push_back(it->second);
+        }
+      }
+    }
+
+    rebuildRegion(cells, region, brickifier, batch);
+  }
+}
+
+static nb::Model build(const nb::Model& a, layer_index_t layers, const EditBatch& batch)
+{
+  nb::Model result(a.info().name);
+  result.prepareLayers(layers);
+  result.apply(batch);
+  return result;
+}
+
+nb::Model nb::Csg::unite(const nb::Model& a, const nb::Model& b, const Brickifier& brickifier)
+{
+  EditBatch batch;
+  std::vector<CutCell> cells;
+
+  a.eachLayer([&a, &batch](layer_index_t position, const Layer* layer) {
+    for (Piece piece : layer->pieces())
+    {
+      piece.moveBy(a.origin());
+      batch.add(position, piece);
+    }
+  });
+
+  clip(b, a, false, batch, cells);
+  rebuild(cells, brickifier, batch);
+
+  return build(a, std::max(a.layerCount(), b.layerCount()), batch);
+}
+
+nb::Model nb::Csg::subtract(const nb::Model& a, const nb::Model& b, const Brickifier& brickifier)
+{
+  EditBatch batch;
+  std::vector<CutCell> cells;
+
+  clip(a, b, false, batch, cells);
+  rebuild(cells, brickifier, batch);
+
+  return build(a, a.layerCount(), batch);
+}
+
+nb::Model nb::Csg::intersect(const nb::Model& a, const nb::Model& b, const Brickifier& brickifier)
+{
+  EditBatch batch;
+  std::vector<CutCell> cells;
+
+  clip(a, b, true, batch, cells);
+  rebuild(cells, brickifier, batch);
+
+  return build(a, std::min(a.layerCount(), b.layerCount()), batch);
+}
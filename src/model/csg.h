@@ -0,0 +1,21 @@
+#pragma once
+
+#include "brickify.h"
+
+namespace nb
+{
+  class Model;
+
+  /* boolean operations between models, layers are matched by position and compared through their occupancy bitmaps,
+     pieces which are only partly kept are cut and the cells left are brickified again */
+  class Csg
+  {
+  public:
+    /* pieces of a together with the parts of b which don't overlap them */
+    static Model unite(const Model& a, const Model& b, const Brickifier& brickifier = Brickifier());
+    /* parts of a which aren't covered by b */
+    static Model subtract(const Model& a, const Model& b, const Brickifier& brickifier = Brickifier());
+    /* parts of a which are covered by b */
+    static Model intersect(const Model& a, const Model& b, const Brickifier& brickifier = Brickifier());
+  };
+}
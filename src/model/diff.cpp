@@ -0,0 +1,237 @@
+#include "diff.h"
+
+#include "validation.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+using namespace nb;
+
+namespace
+{
+  /* layer, position and size of a piece, models don't contain overlapping pieces so it identifies one */
+  uint64_t placeKey(const PieceRecord& record)
+  {
+    const Piece& piece = record.piece;
+    return (uint64_t(uint16_t(record.layer)) << 48) | (uint64_t(uint16_t(piece.x())) << 32) | (uint64_t(uint16_t(piece.y())) << 16)
+      | (uint64_t(piece.width()) << 8) | uint64_t(piece.height());
+  }
+
+  /* everything but color and position */
+  uint32_t looks(const Piece& piece)
+  {
+    const PackedPiece& data = piece.data();
+    return data.orientation | (data.type << 2) | (data.studs << 3);
+  }
+
+  /* layer, size, color and looks of a piece, pieces moved on their layer keep it */
+  uint64_t shapeKey(const PieceRecord& record)
+  {
+    const Piece& piece = record.piece;
+    return (uint64_t(uint16_t(record.layer)) << 48) | (uint64_t(piece.width()) << 40) | (uint64_t(piece.height()) << 32)
+      | (uint64_t(piece.colorIndex()) << 8) | looks(piece);
+  }
+
+  bool same(const PieceRecord& a, const PieceRecord& b)
+  {
+    return placeKey(a) == placeKey(b) && a.piece.colorIndex() == b.piece.colorIndex() && looks(a.piece) == looks(b.piece);
+  }
+
+  std::vector<PieceRecord> records(const nb::Model& model)
+  {
+    std::vector<PieceRecord> result;
+
+    model.eachLayer([&model, &result](layer_index_t position, const Layer* layer) {
+      for (Piece piece : layer->pieces())
+      {
+        piece.moveBy(model.origin());
+        result.push_back({ position, piece });
+      }
+    });
+
+    return result;
+  }
+}
+
+size_t nb::Diff::count(ChangeType type) const
+{
+  return std::count_if(entries.begin(), entries.end(), [type](const Entry& entry) { return entry.type == type; });
+}
+
+Diff nb::Diff::compute(const nb::Model& from, const nb::Model& to)
+{
+  Diff diff;
+
+  const std::vector<PieceRecord> before = records(from), after = records(to);
+
+  std::unordered_map<uint64_t, uint32_t> index;
+  index.reserve(before.size());
+  for (uint32_t i = 0; i < before.size(); ++i)
+    index.emplace(placeKey(before[i]), i);
+
+  /* pieces in the same place are unchanged or recolored, everything else is left for the second pass */
+  std::vector<uint8_t> matched(before.size(), 0);
+  std::vector<uint32_t> added;
+
+  for (uint32_t j = 0; j < after.size(); ++j)
+  {
+    auto it = index.find(placeKey(after[j]));
+    if (it == index.end())
+    {
+      added.push_back(j);
+      continue;
+    }
+
+    const PieceRecord& piece = before[it->second];
+
+    if (looks(piece.piece) != looks(after[j].piece))
+    {
+      added.push_back(j);
+      continue;
+    }
+
+    matched[it->second] = 1;
+    if (piece.piece.colorIndex() != after[j].piece.colorIndex())
+      diff.entries.push_back({ ChangeType::Recolored, piece, after[j] });
+  }
+
+  std::vector<uint32_t> removed;
+  for (uint32_t i = 0; i < before.size(); ++i)
+    if (!matched[i])
+      removed.push_back(i);
+
+  /* removed and added pieces of the same shape are paired up in order of position */
+  auto byPlace = [](const std::vector<PieceRecord>& pieces) {
+    return [&pieces](uint32_t a, uint32_t b) { return placeKey(pieces[a]) < placeKey(pieces[b]); };
+  };
+
+  std::sort(removed.begin(), removed.end(), byPlace(before));
+  std::sort(added.begin(), added.end(), byPlace(after));
+
+  struct Pool
+  {
+    std::vector<uint32_t> pieces;
+    size_t next = 0;
+  };
+
+  std::unordered_map<uint64_t, Pool> pools;
+  for (uint32_t i : removed)
+    pools[shapeKey(before[i])].pieces.push_back(i);
+
+  std::fill(matched.begin(), matched.end(), 0);
+
+  for (uint32_t j : added)
+  {
+    auto it = pools.find(shapeKey(after[j]));
+    if (it != pools.end() && it->second.next < it->second.pieces.size())
+    {
+      const uint32_t i = it->second.pieces[it->second.next++];
+      matched[i] = 1;
+      diff.entries.push_back({ ChangeType::Moved, before[i], after[j] });
+    }
+    else
+      diff.entries.push_back({ ChangeType::Added, PieceRecord(), after[j] });
+  }
+
+  for (uint32_t i : removed)
+    if (!matched[i])
+      diff.entries.push_back({ ChangeType::Removed, before[i], PieceRecord() });
+
+  return diff;
+}
+
+Merge nb::Merge::compute(const nb::Model& base, const nb::Model& ours, const nb::Model& theirs)
+{
+  Merge merge;
+
+  const std::vector<PieceRecord> pieces = records(base);
+  const Diff sides[2] = { Diff::compute(base, ours), Diff::compute(base, theirs) };
+
+  std::unordered_map<uint64_t, uint32_t> index;
+  index.reserve(pieces.size());
+  for (uint32_t i = 0; i < pieces.size(); ++i)
+    index.emplace(placeKey(pieces[i]), i);
+
+  /* change of each side to every base piece, if any */
+  constexpr uint32_t NONE = ~uint32_t(0);
+  std::vector<uint32_t> changes[2] = { std::vector<uint32_t>(pieces.size(), NONE), std::vector<uint32_t>(pieces.size(), NONE) };
+
+  for (size_t side = 0; side < 2; ++side)
+    for (uint32_t e = 0; e < sides[side].entries.size(); ++e)
+      if (sides[side].entries[e].type != ChangeType::Added)
+        changes[side][index[placeKey(sides[side].entries[e].from)]] = e;
+
+  auto outcome = [](const Diff::Entry& entry) {
+    return entry.type == ChangeType::Removed ? std::optional<PieceRecord>() : std::optional<PieceRecord>(entry.to);
+  };
+
+  /* pieces coming from their side go last so that overlaps are resolved in favour of ours */
+  std::vector<PieceRecord> result[2];
+
+  for (uint32_t i = 0; i < pieces.size(); ++i)
+  {
+    const uint32_t o = changes[0][i], t = changes[1][i];
+
+    if (o == NONE && t == NONE)
+      result[0].push_back(pieces[i]);
+    else
+    {
+      const size_t side = o != NONE ? 0 : 1;
+      const auto piece = outcome(sides[side].entries[side == 0 ? o : t]);
+
+      if (o != NONE && t != NONE)
+      {
+        const auto other = outcome(sides[1].entries[t]);
+        if (piece.has_value() != other.has_value() || (piece && !same(*piece, *other)))
+          merge.conflicts.push_back({ ConflictType::Modified, pieces[i], piece, other });
+      }
+
+      if (piece)
+        result[side].push_back(*piece);
+    }
+  }
+
+  /* pieces added by both sides in the same way are added once */
+  std::unordered_map<uint64_t, PieceRecord> ourAdditions;
+  for (const Diff::Entry& entry : sides[0].entries)
+  {
+    if (entry.type == ChangeType::Added)
+    {
+      result[0].push_back(entry.to);
+      ourAdditions.emplace(placeKey(entry.to), entry.to);
+    }
+  }
+
+  for (const Diff::Entry& entry : sides[1].entries)
+  {
+    if (entry.type == ChangeType::Added)
+    {
+      auto it = ourAdditions.find(placeKey(entry.to));
+      if (it == ourAdditions.end() || !same(it->second, entry.to))
+        result[1].push_back(entry.to);
+    }
+  }
+
+  std::vector<PieceRecord> merged = std::move(result[0]);
+  merged.insert(merged.end(), result[1].begin(), result[1].end());
+
+  std::vector<uint8_t> discarded(merged.size(), 0);
+  for (const auto& overlap : Validator::validate(merged))
+  {
+    if (!discarded[overlap.second])
+      merge.conflicts.push_back({ ConflictType::Overlap, std::optional<PieceRecord>(), merged[overlap.first], merged[overlap.second] });
+    discarded[overlap.second] = 1;
+  }
+
+  EditBatch batch;
+  batch.reserve(merged.size());
+  for (size_t i = 0; i < merged.size(); ++i)
+    if (!discarded[i])
+      batch.add(merged[i].layer, merged[i].piece);
+
+  merge.result = nb::Model(ours.info().name);
+  merge.result.prepareLayers(std::max(ours.layerCount(), theirs.layerCount()));
+  merge.result.apply(batch);
+
+  return merge;
+}
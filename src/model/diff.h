@@ -0,0 +1,60 @@
+#pragma once
+
+#include "piece.h"
+#include "journal.h"
+#include "model.h"
+
+#include <vector>
+#include <optional>
+
+namespace nb
+{
+  /* structural difference between two models, pieces are matched by layer position and world coordinates
+     through hash joins on packed keys, unmatched pieces of the same shape and color on a layer count as moved */
+  class Diff
+  {
+  public:
+    struct Entry
+    {
+      ChangeType type;
+      /* piece before the change, unused for Added */
+      PieceRecord from;
+      /* piece after the change, unused for Removed */
+      PieceRecord to;
+    };
+
+    std::vector<Entry> entries;
+
+    size_t count(ChangeType type) const;
+
+    static Diff compute(const Model& from, const Model& to);
+  };
+
+  /* three way merge of two models derived from the same base, changes to different pieces are all applied
+     while a piece changed differently by both sides keeps our change and is reported as a conflict */
+  class Merge
+  {
+  public:
+    enum class ConflictType
+    {
+      /* both sides changed the same base piece in different ways */
+      Modified,
+      /* a piece of their side overlaps a piece of ours, it's left out of the result */
+      Overlap
+    };
+
+    struct Conflict
+    {
+      ConflictType type;
+      std::optional<PieceRecord> base;
+      /* outcome on each side, empty if the piece was removed */
+      std::optional<PieceRecord> ours;
+      std::optional<PieceRecord> theirs;
+    };
+
+    Model result;
+    std::vector<Conflict> conflicts;
+
+    static Merge compute(const Model& base, const Model& ours, const Model& theirs);
+  };
+}
@@ -0,0 +1,209 @@
+#include "history.h"
+
+#include "model.h"
+
+#include <unordered_set>
+
+using namespace nb;
+
+void nb::History::push(Step&& step)
+{
+  /* a new step discards everything that could be redone */
+  while (_steps.size() > _position)
+  {
+    _memory -= _steps.back().memory();
+    _steps.pop_back();
+  }
+
+  step.removed.shrink_to_fit();
+  step.added.shrink_to_fit();
+  step.time = std::chrono::steady_clock::now();
+  _memory += step.memory();
+  _steps.push_back(std::move(step));
+  ++_position;
+
+  trim();
+}
+
+void nb::History::trim()
+{
+  /* oldest steps are dropped first, the latest one is always kept */
+  while (_memory > _memoryLimit && _position > 1)
+  {
+    _memory -= _steps.front().memory();
+    _steps.pop_front();
+    --_position;
+  }
+}
+
+std::optional<History::Entry> nb::History::entry(const Model& model, PieceHandle handle)
+{
+  auto record = model.record(handle);
+  if (!record)
+    return std::nullopt;
+
+  return Entry{ model.layer(record->layer)->id(), record->piece };
+}
+
+void nb::History::replace(Model& model, const std::vector<Entry>& from, const std::vector<Entry>& to)
+{
+  EditBatch batch;
+  batch.reserve(to.size());
+
+  for (const auto& entry : from)
+  {
+    /* occupancy index is built if a bake or a bulk batch left it stale, so the lookup doesn't fall back to a scan */
+    const Layer* layer = model.layerById(entry.layer);
+    if (layer)
+    {
+      layer->occupancy();
+      batch.remove(model.handle(coord3d_t(entry.piece.coord(), model.position(entry.layer))));
+    }
+  }
+
+  for (const auto& entry : to)
+    if (model.layerById(entry.layer))
+      batch.add(model.position(entry.layer), entry.piece);
+
+  model.apply(batch);
+}
+
+std::vector<PieceHandle> nb::History::apply(Model& model, const EditBatch& batch)
+{
+  Step step;
+  step.removed.reserve(batch._removals.size() + batch._movements.size());
+  step.added.reserve(batch._insertions.size() + batch._movements.size());
+
+  /* every piece is recorded once, removals come first in the batch so removed pieces are never moved by it */
+  std::unordered_set<uint32_t> removed;
+
+  for (PieceHandle handle : batch._removals)
+  {
+    auto before = entry(model, handle);
+    if (before && removed.insert(handle.index).second)
+      step.removed.push_back(*before);
+  }
+
+  /* state before the batch of each piece it moves, the state after is read back once the movements which
+     the model accepted are known, so that rejected movements aren't recorded */
+  std::vector<std::pair<PieceHandle, Entry>> moves;
+  std::unordered_set<uint32_t> moving;
+
+  for (const auto& movement : batch._movements)
+  {
+    if (removed.count(movement.handle.index) || moving.count(movement.handle.index))
+      continue;
+
+    auto before = entry(model, movement.handle);
+    if (before)
+    {
+      moves.push_back({ movement.handle, *before });
+      moving.insert(movement.handle.index);
+    }
+  }
+
+  std::vector<bool> applied;
+  std::vector<PieceHandle> handles = model.apply(batch, &applied);
+
+  std::unordered_set<uint32_t> displaced;
+  for (size_t i = 0; i < applied.size(); ++i)
+    if (applied[i])
+      displaced.insert(batch._movements[i].handle.index);
+
+  for (const auto& move : moves)
+  {
+    auto after = displaced.count(move.first.index) ? entry(model, move.first) : std::nullopt;
+    if (after)
+    {
+      step.removed.push_back(move.second);
+      step.added.push_back(*after);
+    }
+  }
+
+  for (size_t i = 0; i < handles.size(); ++i)
+  {
+    auto added = handles[i] ? entry(model, handles[i]) : std::nullopt;
+    if (added)
+      step.added.push_back(*added);
+  }
+
+  if (!step.removed.empty() || !step.added.empty())
+    push(std::move(step));
+
+  return handles;
+}
+
+PieceHandle nb::History::add(Model& model, layer_index_t layer, const Piece& piece)
+{
+  EditBatch batch;
+  batch.add(layer, piece);
+  return apply(model, batch).front();
+}
+
+void nb::History::remove(Model& model, PieceHandle handle)
+{
+  EditBatch batch;
+  batch.remove(handle);
+  apply(model, batch);
+}
+
+void nb::History::shift(Model& model, Direction direction)
+{
+  const coord2d_t before = model.origin();
+  if (!model.shift(direction))
+    return;
+
+  const coord2d_t delta = coord2d_t(model.origin().x - before.x, model.origin().y - before.y);
+
+  /* consecutive shifts, like the ones of a held key, become a single step */
+  const auto now = std::chrono::steady_clock::now();
+  if (_position > 0 && _position == _steps.size())
+  {
+    Step& last = _steps.back();
+    if (last.removed.empty() && last.added.empty() && now - last.time < COALESCE_INTERVAL)
+    {
+      last.shift += delta;
+      last.time = now;
+      return;
+    }
+  }
+
+  Step step;
+  step.shift = delta;
+  push(std::move(step));
+}
+
+bool nb::History::undo(Model& model)
+{
+  if (!canUndo())
+    return false;
+
+  const Step& step = _steps[--_position];
+
+  if (step.shift.x || step.shift.y)
+    model.shift(coord2d_t(-step.shift.x, -step.shift.y));
+  replace(model, step.added, step.removed);
+
+  return true;
+}
+
+bool nb::History::redo(Model& model)
+{
+  if (!canRedo())
+    return false;
+
+  const Step& step = _steps[_position++];
+
+  replace(model, step.removed, step.added);
+  if (step.shift.x || step.shift.y)
+    model.shift(step.shift);
+
+  return true;
+}
+
+void nb::History::clear()
+{
+  _steps.clear();
+  _position = 0;
+  _memory = 0;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "piece.h"
+#include "batch.h"
+
+#include <deque>
+#include <vector>
+#include <chrono>
+#include <optional>
+
+namespace nb
+{
+  class Model;
+
+  /* undo/redo stack, every step stores only the pieces it removed and added as packed records in world space
+     together with the shift it applied, pieces are found again by position so steps stay valid across undo/redo,
+     layers are referred to by id so that steps keep targeting the same layer after layers are inserted, removed
+     or reordered, pieces of a layer which has been removed since are skipped */
+  class History
+  {
+  public:
+    static constexpr size_t DEFAULT_MEMORY_LIMIT = 64 << 20;
+    /* shifts done within this interval from the previous one are merged into a single step */
+    static constexpr std::chrono::milliseconds COALESCE_INTERVAL = std::chrono::milliseconds(500);
+
+  protected:
+    struct Entry
+    {
+      layer_id_t layer;
+      Piece piece;
+    };
+
+    struct Step
+    {
+      std::vector<Entry> removed;
+      std::vector<Entry> added;
+      coord2d_t shift;
+      std::chrono::steady_clock::time_point time;
+
+      size_t memory() const { return sizeof(Step) + (removed.capacity() + added.capacity()) * sizeof(Entry); }
+    };
+
+    /* steps before _position can be undone, the ones after it redone */
+    std::deque<Step> _steps;
+    size_t _position;
+    size_t _memory;
+    size_t _memoryLimit;
+
+    void push(Step&& step);
+    void trim();
+    static std::optional<Entry> entry(const Model& model, PieceHandle handle);
+    /* removes the pieces in from and adds the ones in to with a single batch */
+    static void replace(Model& model, const std::vector<Entry>& from, const std::vector<Entry>& to);
+
+  public:
+    History(size_t memoryLimit = DEFAULT_MEMORY_LIMIT) : _position(0), _memory(0), _memoryLimit(memoryLimit) { }
+
+    std::vector<PieceHandle> apply(Model& model, const EditBatch& batch);
+    PieceHandle add(Model& model, layer_index_t layer, const Piece& piece);
+    void remove(Model& model, PieceHandle handle);
+    void shift(Model& model, Direction direction);
+
+    bool undo(Model& model);
+    bool redo(Model& model);
+
+    bool canUndo() const { return _position > 0; }
+    bool canRedo() const { return _position < _steps.size(); }
+
+    void clear();
+
+    void setMemoryLimit(size_t limit) { _memoryLimit = limit; trim(); }
+    size_t memory() const { return _memory; }
+  };
+}
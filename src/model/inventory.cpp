@@ -0,0 +1,228 @@
+#include "inventory.h"
+
+#include "model.h"
+
+#include <algorithm>
+#include <bit>
+
+using namespace nb;
+
+struct PartOption
+{
+  size2d_t size;
+  size_t part;
+};
+
+struct PartPlacement
+{
+  coord2d_t position;
+  size2d_t size;
+  size_t part;
+};
+
+/* parts of a color and type still in stock, options hold every part in both orientations by decreasing area */
+struct PartGroup
+{
+  std::vector<PartOption> options;
+  std::vector<size_t> counts;
+  /* last combination found for each piece size, tried first for the next piece of the same size */
+  std::unordered_map<uint32_t, std::vector<PartPlacement>> cache;
+};
+
+/* covers a bitmap of up to 64 columns, each step fills the first free cell so every combination is visited once */
+struct PartSearch
+{
+  coord_t width;
+  coord_t height;
+  uint64_t full;
+  std::vector<uint64_t> rows;
+  PartGroup& group;
+  std::vector<PartPlacement> placements;
+  size_t nodes;
+
+  PartSearch(size2d_t size, PartGroup& group) : width(size.width), height(size.height), rows(size.height, 0), group(group), nodes(0)
+  {
+    full = width == 64 ? ~uint64_t(0) : ((uint64_t(1) << width) - 1);
+  }
+
+  bool run(coord_t row)
+  {
+    while (row < height && rows[row] == full)
+      ++row;
+
+    if (row == height)
+      return true;
+    else if (++nodes > InventorySolver::SEARCH_LIMIT)
+      return false;
+
+    const coord_t x = std::countr_zero(~rows[row]);
+
+    for (const PartOption& option : group.options)
+    {
+      const coord_t w = option.size.width, h = option.size.height;
+      if (!group.counts[option.part] || x + w > width || row + h > height)
+        continue;
+
+      const uint64_t mask = (w == 64 ? ~uint64_t(0) : ((uint64_t(1) << w) - 1)) << x;
+
+      bool free = true;
+      for (coord_t r = row; r < row + h && free; ++r)
+        free = !(rows[r] & mask);
+
+      if (!free)
+        continue;
+
+      for (coord_t r = row; r < row + h; ++r)
+        rows[r] |= mask;
+      --group.counts[option.part];
+      placements.push_back({ coord2d_t(x, row), option.size, option.part });
+
+      if (run(row))
+        return true;
+
+      placements.pop_back();
+      ++group.counts[option.part];
+      for (coord_t r = row; r < row + h; ++r)
+        rows[r] &= ~mask;
+    }
+
+    return false;
+  }
+};
+
+/* takes the parts of a previous combination if they're all still in stock */
+static bool consume(PartGroup& group, const std::vector<PartPlacement>& placements)
+{
+  for (size_t i = 0; i < placements.size(); ++i)
+  {
+    if (!group.counts[placements[i].part])
+    {
+      while (i > 0)
+        ++group.counts[placements[--i].part];
+      return false;
+    }
+
+    --group.counts[placements[i].part];
+  }
+
+  return true;
+}
+
+InventorySolver::Solution nb::InventorySolver::solve(const Model& model, const Inventory& inventory)
+{
+  Solution solution;
+
+  struct Entry
+  {
+    PieceRecord record;
+    PieceHandle handle;
+  };
+
+  std::vector<Entry> pieces;
+  model.query(bounds3d_t(model.bounds(), 0, model.layerCount()), [&pieces](const PieceRecord& record, PieceHandle handle) {
+    pieces.push_back({ record, handle });
+  });
+
+  /* the query follows the order of the chunks in the occupancy index, pieces are sorted so that the same model and
+     inventory always give the same solution */
+  std::sort(pieces.begin(), pieces.end(), [](const Entry& a, const Entry& b) {
+    const Piece& pa = a.record.piece, &pb = b.record.piece;
+    if (a.record.layer != b.record.layer)
+      return a.record.layer < b.record.layer;
+    return pa.y() != pb.y() ? pa.y() < pb.y() : pa.x() < pb.x();
+  });
+
+  /* pieces coming first take the parts in stock, the ones exceeding it need to be replaced */
+  std::unordered_map<uint32_t, size_t> remaining = inventory.parts();
+  std::vector<size_t> excess;
+
+  for (size_t i = 0; i < pieces.size(); ++i)
+  {
+    const Piece& piece = pieces[i].record.piece;
+    auto it = remaining.find(Inventory::key(piece.size(), piece.colorIndex(), piece.type()));
+
+    if (it != remaining.end() && it->second)
+      --it->second;
+    else
+      excess.push_back(i);
+  }
+
+  if (excess.empty())
+    return solution;
+
+  /* groups are keyed by color and type */
+  std::unordered_map<uint32_t, PartGroup> groups;
+  for (const auto& entry : remaining)
+  {
+    if (!entry.second)
+      continue;
+
+    PartGroup& group = groups[entry.first >> 16];
+    const size2d_t size = Inventory::size(entry.first);
+
+    group.options.push_back({ size, group.counts.size() });
+    if (size.width != size.height)
+      group.options.push_back({ size2d_t(size.height, size.width), group.counts.size() });
+    group.counts.push_back(entry.second);
+  }
+
+  for (auto& entry : groups)
+  {
+    std::sort(entry.second.options.begin(), entry.second.options.end(), [](const PartOption& a, const PartOption& b) {
+      return a.size.width * a.size.height != b.size.width * b.size.height ? a.size.width * a.size.height > b.size.width * b.size.height : a.size.width > b.size.width;
+    });
+  }
+
+  for (size_t i : excess)
+  {
+    const Entry& entry = pieces[i];
+    const Piece& piece = entry.record.piece;
+    auto it = groups.find(Inventory::key(piece.size(), piece.colorIndex(), piece.type()) >> 16);
+
+    /* round pieces can't be split into smaller parts */
+    if (it == groups.end() || piece.type() != PieceType::Square)
+    {
+      solution.unresolved.push_back(entry.handle);
+      continue;
+    }
+
+    /* bitmaps are searched with their short side as columns */
+    const bool transposed = piece.width() > 64;
+    const size2d_t size = transposed ? size2d_t(piece.height(), piece.width()) : piece.size();
+
+    if (size.width > 64)
+    {
+      solution.unresolved.push_back(entry.handle);
+      continue;
+    }
+
+    PartGroup& group = it->second;
+    auto& cached = group.cache[uint32_t(size.width) | (uint32_t(size.height) << 8)];
+
+    if (cached.empty() || !consume(group, cached))
+    {
+      PartSearch search(size, group);
+      if (!search.run(0))
+      {
+        solution.unresolved.push_back(entry.handle);
+        continue;
+      }
+
+      cached = std::move(search.placements);
+    }
+
+    solution.batch.remove(entry.handle);
+
+    for (const PartPlacement& placement : cached)
+    {
+      const coord2d_t offset = transposed ? coord2d_t(placement.position.y, placement.position.x) : placement.position;
+      Piece part = piece.derive(transposed ? size2d_t(placement.size.height, placement.size.width) : placement.size);
+      part.moveBy(offset);
+      solution.batch.add(entry.record.layer, part);
+    }
+
+    ++solution.replaced;
+  }
+
+  return solution;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "piece.h"
+#include "batch.h"
+
+#include <vector>
+#include <unordered_map>
+
+namespace nb
+{
+  class Model;
+
+  /* stock of parts, a part is a size together with a color and a type, sizes are the same part in both orientations */
+  class Inventory
+  {
+  protected:
+    std::unordered_map<uint32_t, size_t> _stock;
+
+  public:
+    /* sides must not exceed Piece::MAX_SIZE, they're packed in 8 bits each */
+    static uint32_t key(size2d_t size, palette_index_t color, PieceType type)
+    {
+      const uint32_t a = std::min(size.width, size.height), b = std::max(size.width, size.height);
+      return a | (b << 8) | (uint32_t(color) << 16) | (uint32_t(type) << 24);
+    }
+
+    static size2d_t size(uint32_t key) { return size2d_t(key & 0xFF, (key >> 8) & 0xFF); }
+    static palette_index_t color(uint32_t key) { return static_cast<palette_index_t>((key >> 16) & 0xFF); }
+    static PieceType type(uint32_t key) { return static_cast<PieceType>(key >> 24); }
+
+    void add(size2d_t size, palette_index_t color, PieceType type, size_t count) { _stock[key(size, color, type)] += count; }
+    size_t count(uint32_t key) const { auto it = _stock.find(key); return it != _stock.end() ? it->second : 0; }
+
+    const auto& parts() const { return _stock; }
+    bool empty() const { return _stock.empty(); }
+  };
+
+  /* rewrites the pieces of a model which exceed the inventory into combinations of stocked parts of the same color
+     and type which cover the same cells, combinations are found by a depth first search that fills a bitmap of
+     the piece one row at a time */
+  class InventorySolver
+  {
+  public:
+    /* nodes visited by the search of a single piece before it's given up */
+    static constexpr size_t SEARCH_LIMIT = 4096;
+
+    struct Solution
+    {
+      /* removes the pieces which are replaced and adds their replacements */
+      EditBatch batch;
+      size_t replaced = 0;
+      /* pieces over stock that no combination of the remaining parts could cover */
+      std::vector<PieceHandle> unresolved;
+    };
+
+    static Solution solve(const Model& model, const Inventory& inventory);
+  };
+}
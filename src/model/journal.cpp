@@ -0,0 +1,35 @@
+#include "journal.h"
+
+#include <atomic>
+
+using namespace nb;
+
+static uint64_t NextJournalId()
+{
+  static std::atomic<uint64_t> counter(0);
+  return counter.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+nb::Journal::Journal() : _id(NextJournalId()), _next(0), _count(0) { }
+
+nb::Journal::Journal(const Journal& other) : _changes(other._changes), _id(NextJournalId()), _next(other._next), _count(other._count) { }
+
+nb::Journal& nb::Journal::operator=(const Journal& other)
+{
+  _changes = other._changes;
+  _id = NextJournalId();
+  _next = other._next;
+  _count = other._count;
+  return *this;
+}
+
+void nb::Journal::record(const Change& change)
+{
+  if (_changes.empty())
+    _changes.resize(CAPACITY, change);
+
+  _changes[_next % CAPACITY] = change;
+
+  ++_next;
+  _count = std::min(_count + 1, CAPACITY);
+}
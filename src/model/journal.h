@@ -0,0 +1,81 @@
+#pragma once
+
+#include "piece.h"
+
+#include <vector>
+
+namespace nb
+{
+  enum class ChangeType : uint8_t
+  {
+    Added,
+    Removed,
+    Moved,
+    Recolored
+  };
+
+  /* single piece edit, piece is stored in layer space as it is after the change (before it for removals) */
+  struct Change
+  {
+    ChangeType type;
+    /* id of the layer, see Layer::id */
+    layer_id_t layer;
+    PieceHandle handle;
+    Piece piece;
+    /* movement for Moved, unused otherwise */
+    coord2d_t delta;
+    /* color before the change for Recolored, unused otherwise */
+    palette_index_t previousColor = Palette::NONE;
+  };
+
+  /* ring buffer of the latest changes applied to a model, readers keep a cursor with the sequence number
+     of the next change they expect and catch up by reading what has been recorded after it,
+     edits which can't be described piece by piece (layer structure, bake) discard it so that readers resync */
+  class Journal
+  {
+  public:
+    static constexpr size_t CAPACITY = 1 << 12;
+
+  protected:
+    std::vector<Change> _changes;
+    /* tells journals apart, cursors are meaningful only for the journal they were taken from */
+    uint64_t _id;
+    uint64_t _next;
+    /* number of changes still readable */
+    size_t _count;
+
+  public:
+    Journal();
+    /* a copy gets a new id since its history diverges from the original one from now on */
+    Journal(const Journal& other);
+    Journal(Journal&&) = default;
+    Journal& operator=(const Journal& other);
+    Journal& operator=(Journal&&) = default;
+
+    void record(const Change& change);
+    /* drops all recorded changes, readers behind the current version will have to resync */
+    void discard() { ++_next; _count = 0; }
+
+    uint64_t id() const { return _id; }
+    /* sequence number which will be assigned to the next change */
+    uint64_t version() const { return _next; }
+    /* true if the changes after cursor are still in the buffer */
+    bool available(uint64_t cursor) const { return _next - cursor <= _count; }
+
+    /* calls f(change) for every change after cursor and advances it, returns false without calling f
+       if some of them have already been overwritten, the reader must then resync from the model itself */
+    template<typename F> bool read(uint64_t& cursor, F&& f) const
+    {
+      if (!available(cursor))
+      {
+        cursor = _next;
+        return false;
+      }
+
+      for (; cursor < _next; ++cursor)
+        f(_changes[cursor % CAPACITY]);
+
+      return true;
+    }
+  };
+}
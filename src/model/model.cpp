@@ -1,105 +1,646 @@
 #include "model.h"
 
+#include <algorithm>
+#include <atomic>
+
 using namespace nb;
 
-Piece* nb::Layer::piece(const coord2d_t& coord) const
+/* versions of all layers come from a single counter, so a version never describes two different sets of pieces,
+   even across models whose layers share the same ids */
+static uint64_t NextLayerVersion()
+{
+  static std::atomic<uint64_t> counter(0);
+  return counter.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+void nb::Layer::add(const Piece& piece, uint32_t slot)
+{
+  if (_indexed)
+    _occupancy.mark(piece, static_cast<piece_index_t>(_pieces.size()));
+  _pieces.push_back(piece);
+  _slots.push_back(slot);
+
+  if (!_boundsDirty)
+    _bounds.merge(piece.bounds());
+
+  _version = NextLayerVersion();
+}
+
+void nb::Layer::remove(size_t index)
 {
-  for (const auto& p : _pieces)
+  if (_indexed)
+    _occupancy.unmark(_pieces[index], static_cast<piece_index_t>(index));
+
+  /* bounds can shrink only if piece was on the border, recompute them lazily in that case */
+  if (_bounds.touchesEdge(_pieces[index].bounds()))
+    _boundsDirty = true;
+
+  /* swap with last piece so that only the references to it must be fixed */
+  _pieces.swapRemove(index);
+  if (index != _slots.size() - 1)
   {
-    if (coord.x >= p.x() && coord.x < p.x() + p.width() &&  
-       coord.y >= p.y() && coord.y < p.y() + p.height())
-      return const_cast<Piece*>(&p);
+    _slots[index] = _slots.back();
+    if (_indexed)
+      _occupancy.relink(_pieces[index], static_cast<piece_index_t>(_slots.size() - 1), static_cast<piece_index_t>(index));
   }
-  return nullptr;
+
+  _slots.pop_back();
+  _version = NextLayerVersion();
 }
 
-void nb::Model::linkLayers(Layer* prev, Layer* next)
+bool nb::Layer::move(size_t index, coord2d_t delta)
 {
-  if (prev) prev->_next = next;
-  if (next) next->_prev = prev;
+  Piece piece = _pieces[index];
+
+  /* the piece leaves its cells first so that it can move over them, it's put back if the destination is taken */
+  reindex();
+  _occupancy.unmark(piece, static_cast<piece_index_t>(index));
+
+  if (_occupancy.intersects(piece.bounds().translated(delta)))
+  {
+    _occupancy.mark(piece, static_cast<piece_index_t>(index));
+    return false;
+  }
+
+  if (_bounds.touchesEdge(piece.bounds()))
+    _boundsDirty = true;
+
+  piece.moveBy(delta);
+  _pieces.set(index, piece);
+
+  _occupancy.mark(piece, static_cast<piece_index_t>(index));
+
+  if (!_boundsDirty)
+    _bounds.merge(piece.bounds());
+
+  _version = NextLayerVersion();
+  return true;
 }
 
-void nb::Model::addLayer(layer_index_t index)
+void nb::Layer::recolor(size_t index, const PieceColor* color)
 {
-  auto newLayer = std::make_unique<Layer>();
-  newLayer->_index = index;
+  Piece piece = _pieces[index];
+  piece.dye(color);
+  _pieces.set(index, piece);
+
+  _version = NextLayerVersion();
+}
+
+void nb::Layer::translate(coord_t dx, coord_t dy)
+{
+  /* index is rebuilt lazily on the next edit or lookup, a bake moving every layer doesn't rebuild all of them at once */
+  _pieces.translate(dx, dy);
+  _occupancy.clear();
+  _indexed = false;
+
+  _bounds = _bounds.translated(coord2d_t(dx, dy));
+  _version = NextLayerVersion();
+}
 
-  if (index > 0)
+void nb::Layer::invalidate()
+{
+  _occupancy.clear();
+  _indexed = false;
+}
+
+void nb::Layer::reindex() const
+{
+  if (_indexed)
+    return;
+
+  for (size_t i = 0; i < _pieces.size(); ++i)
+    _occupancy.mark(_pieces[i], static_cast<piece_index_t>(i));
+  _indexed = true;
+}
+
+const bounds2d_t& nb::Layer::bounds() const
+{
+  if (_boundsDirty)
   {
-    Layer* prev = _layers[index - 1].get();
-    linkLayers(prev, newLayer.get());
+    /* only chunks which changed need to recompute their own bounds */
+    _bounds = bounds2d_t();
+    for (const auto& entry : occupancy().chunks())
+      _bounds.merge(entry.second.bounds());
+    _boundsDirty = false;
   }
 
-  if (index < _layers.size())
+  return _bounds;
+}
+
+size_t nb::Layer::find(const coord2d_t& coord) const
+{
+  /* index dropped by a bulk batch or a bake is rebuilt here at the latest, so lookups never fall back to a scan */
+  reindex();
+
+  auto index = _occupancy.at(coord);
+  return index != OccupancyIndex::INVALID ? index : PieceStorage::NOT_FOUND;
+}
+
+std::optional<Piece> nb::Layer::piece(const coord2d_t& coord) const
+{
+  size_t index = find(coord);
+  return index != PieceStorage::NOT_FOUND ? _pieces[index] : std::optional<Piece>();
+}
+
+Layer* nb::Model::edit(layer_id_t id)
+{
+  auto& layer = _layers[id];
+
+  if (layer.use_count() > 1)
+    layer = std::make_shared<Layer>(*layer);
+  else
   {
-    Layer* nextLayer = _layers[index].get();
-    linkLayers(newLayer.get(), nextLayer);
+    /* pairs with the release of the last snapshot reference, so its reads happen before any write below */
+    std::atomic_thread_fence(std::memory_order_acquire);
   }
 
-  for (layer_index_t i = index; i < _layers.size(); ++i)
-    _layers[i]->_index += 1;
+  return layer.get();
+}
 
-  index = std::min(index, static_cast<layer_index_t>(_layers.size()));
-  _layers.insert(_layers.begin() + index, std::move(newLayer));
+layer_id_t nb::Model::createLayer(layer_index_t position)
+{
+  /* ids are never reused so that stale ones can't refer to a different layer */
+  layer_id_t id = static_cast<layer_id_t>(_layers.size());
+  _layers.push_back(std::make_shared<Layer>(id));
+  _order.insert(id, position);
+  return id;
+}
+
+layer_id_t nb::Model::addLayer(layer_index_t index)
+{
+  layer_id_t id = createLayer(index);
+  _journal.discard();
+  ++_revision;
+  return id;
+}
+
+void nb::Model::removeLayer(layer_index_t index)
+{
+  layer_id_t id = _order.at(index);
+  if (id == LayerOrder::NIL)
+    return;
+
+  const Layer* layer = _layers[id].get();
+  for (size_t i = 0; i < layer->_pieces.size(); ++i)
+  {
+    PieceSlot& slot = _slots[layer->_slots[i]];
+    slot.layer = NO_LAYER;
+    ++slot.generation;
+    _freeSlots.push_back(layer->_slots[i]);
+  }
+
+  if (!layer->_pieces.empty())
+    _boundsDirty = true;
+
+  _order.erase(id);
+  _layers[id].reset();
+
+  _journal.discard();
+  ++_revision;
+}
+
+void nb::Model::moveLayer(layer_index_t from, layer_index_t to)
+{
+  layer_id_t id = _order.at(from);
+  if (id == LayerOrder::NIL)
+    return;
+
+  _order.erase(id);
+  _order.insert(id, to);
+
+  _journal.discard();
+  ++_revision;
+}
+
+layer_id_t nb::Model::duplicateLayer(layer_index_t index)
+{
+  layer_id_t source = _order.at(index);
+  if (source == LayerOrder::NIL)
+    return LayerOrder::NIL;
+
+  layer_id_t id = static_cast<layer_id_t>(_layers.size());
+  _layers.push_back(std::make_shared<Layer>(*_layers[source]));
+  _order.insert(id, index + 1);
+
+  /* copy shares storage and occupancy layout with the source, only slots must be new */
+  Layer* layer = _layers[id].get();
+  layer->_id = id;
+
+  for (size_t i = 0; i < layer->_pieces.size(); ++i)
+  {
+    uint32_t slot;
+    if (!_freeSlots.empty())
+    {
+      slot = _freeSlots.back();
+      _freeSlots.pop_back();
+    }
+    else
+    {
+      slot = static_cast<uint32_t>(_slots.size());
+      _slots.push_back({ NO_LAYER, 0, 0 });
+    }
+
+    _slots[slot].layer = id;
+    _slots[slot].index = static_cast<uint32_t>(i);
+    layer->_slots[i] = slot;
+  }
+
+  _journal.discard();
+  ++_revision;
+  return id;
 }
 
 void nb::Model::prepareLayers(layer_index_t count)
 {
-  _layers.resize(count);
-  for (layer_index_t i = 0; i < count; ++i)
-    _layers[i] = std::make_unique<Layer>(i);
+  /* current layers go away like removed ones, their ids are not given out again and handles to their pieces stay invalid */
+  for (auto& layer : _layers)
+    layer.reset();
 
-  for (size_t i = 0; i < _layers.size(); ++i)
+  for (uint32_t i = 0; i < _slots.size(); ++i)
   {
-    auto current = _layers[i].get();
-    auto next = (i + 1 < _layers.size()) ? _layers[i + 1].get() : nullptr;
-    linkLayers(current, next);
+    if (_slots[i].layer != NO_LAYER)
+    {
+      _slots[i].layer = NO_LAYER;
+      ++_slots[i].generation;
+      _freeSlots.push_back(i);
+    }
   }
+
+  _order.clear();
+  _bounds = bounds2d_t();
+  _boundsDirty = false;
+  _origin = coord2d_t(0, 0);
+
+  for (layer_index_t i = 0; i < count; ++i)
+    createLayer(i);
+
+  _journal.discard();
+  ++_revision;
 }
 
-void nb::Model::addPiece(layer_index_t layerIndex, const Piece& piece)
+PieceHandle nb::Model::addPiece(layer_index_t layerIndex, const Piece& piece)
 {
-  auto* layer = this->layer(layerIndex);
-  if (layer)
-    layer->add(piece);
+  if (!this->layer(layerIndex))
+    return PieceHandle();
+
+  Layer* layer = edit(_order.at(layerIndex));
+  layer->reindex();
+  PieceHandle handle = insert(layer, piece);
+  ++_revision;
+
+  return handle;
+}
+
+PieceHandle nb::Model::insert(Layer* layer, const Piece& piece)
+{
+  /* pieces which wouldn't fit in 16 bit coordinates once relative to the origin are rejected */
+  if (!Piece::fits(piece.bounds().translated(coord2d_t(-_origin.x, -_origin.y))))
+    return PieceHandle();
+
+  Piece local = piece;
+  local.moveBy(-_origin.x, -_origin.y);
+
+  /* overlapping pieces would share cells of the occupancy index, which keeps a single piece per cell */
+  layer->reindex();
+  if (layer->_occupancy.intersects(local.bounds()))
+    return PieceHandle();
+
+  uint32_t slot;
+  if (!_freeSlots.empty())
+  {
+    slot = _freeSlots.back();
+    _freeSlots.pop_back();
+  }
+  else
+  {
+    slot = static_cast<uint32_t>(_slots.size());
+    _slots.push_back({ NO_LAYER, 0, 0 });
+  }
+
+  _slots[slot].layer = layer->_id;
+  _slots[slot].index = static_cast<uint32_t>(layer->_pieces.size());
+  layer->add(local, slot);
+
+  if (!_boundsDirty)
+    _bounds.merge(local.bounds());
+
+  PieceHandle handle(slot, _slots[slot].generation);
+  _journal.record({ ChangeType::Added, layer->_id, handle, local, coord2d_t() });
+
+  return handle;
 }
 
-Piece* nb::Model::piece(const coord3d_t& coord) const
+std::optional<Piece> nb::Model::piece(const coord3d_t& coord) const
 {
   const Layer* layer = this->layer(coord.z);
 
   if (layer)
-    return layer->piece(coord.xy());
+  {
+    auto piece = layer->piece(coord2d_t(coord.x - _origin.x, coord.y - _origin.y));
+    if (piece)
+      piece->moveBy(_origin);
+    return piece;
+  }
 
-  return nullptr;
+  return std::optional<Piece>();
 }
 
-void nb::Model::remove(const Piece* p)
+std::optional<Piece> nb::Model::piece(PieceHandle handle) const
 {
-  for (auto& layer : _layers)
+  if (valid(handle))
+  {
+    Piece piece = _layers[_slots[handle.index].layer]->_pieces[_slots[handle.index].index];
+    piece.moveBy(_origin);
+    return piece;
+  }
+
+  return std::optional<Piece>();
+}
+
+std::optional<PieceRecord> nb::Model::record(PieceHandle handle) const
+{
+  auto piece = this->piece(handle);
+  if (piece)
+    return PieceRecord{ _order.position(_slots[handle.index].layer), *piece };
+
+  return std::optional<PieceRecord>();
+}
+
+PieceHandle nb::Model::handle(const coord3d_t& coord) const
+{
+  const Layer* layer = this->layer(coord.z);
+
+  if (layer)
   {
-    for (auto it = layer->_pieces.begin(); it != layer->_pieces.end(); ++it)
+    size_t index = layer->find(coord2d_t(coord.x - _origin.x, coord.y - _origin.y));
+    if (index != PieceStorage::NOT_FOUND)
     {
-      if (&(*it) == p)
-      {
-        layer->_pieces.erase(it);
-        return;
-      }
+      uint32_t slot = layer->_slots[index];
+      return PieceHandle(slot, _slots[slot].generation);
     }
   }
+
+  return PieceHandle();
+}
+
+void nb::Model::remove(PieceHandle handle)
+{
+  if (!valid(handle))
+    return;
+
+  edit(_slots[handle.index].layer)->reindex();
+  erase(handle);
+  ++_revision;
+}
+
+void nb::Model::erase(PieceHandle handle)
+{
+  PieceSlot& slot = _slots[handle.index];
+  Layer* layer = edit(slot.layer);
+  const Piece piece = layer->_pieces[slot.index];
+
+  _journal.record({ ChangeType::Removed, layer->_id, handle, piece, coord2d_t() });
+
+  if (_bounds.touchesEdge(piece.bounds()))
+    _boundsDirty = true;
+
+  layer->remove(slot.index);
+
+  /* last piece of the layer has been moved in place of the removed one */
+  if (slot.index < layer->_slots.size())
+    _slots[layer->_slots[slot.index]].index = slot.index;
+
+  slot.layer = NO_LAYER;
+  ++slot.generation;
+  _freeSlots.push_back(handle.index);
+}
+
+bool nb::Model::move(PieceHandle handle, coord2d_t delta)
+{
+  if (!valid(handle))
+    return false;
+
+  edit(_slots[handle.index].layer)->reindex();
+  if (!displace(handle, delta))
+    return false;
+
+  ++_revision;
+  return true;
+}
+
+bool nb::Model::displace(PieceHandle handle, coord2d_t delta)
+{
+  const PieceSlot& slot = _slots[handle.index];
+  Piece piece = _layers[slot.layer]->_pieces[slot.index];
+
+  /* both layer and world space coordinates must stay in range */
+  const bounds2d_t destination = piece.bounds().translated(delta);
+  if (!Piece::fits(destination) || !Piece::fits(destination.translated(_origin)))
+    return false;
+
+  Layer* layer = edit(slot.layer);
+  if (!layer->move(slot.index, delta))
+    return false;
+
+  if (_bounds.touchesEdge(piece.bounds()))
+    _boundsDirty = true;
+
+  if (!_boundsDirty)
+    _bounds.merge(piece.bounds().translated(delta));
+
+  piece.moveBy(delta);
+  _journal.record({ ChangeType::Moved, slot.layer, handle, piece, delta });
+  return true;
 }
 
-void nb::Model::shift(Direction direction)
+void nb::Model::recolor(PieceHandle handle, const PieceColor* color)
 {
-  for (const auto& layer : _layers)
-    for (auto& piece : layer->pieces())
+  if (!valid(handle))
+    return;
+
+  const PieceSlot& slot = _slots[handle.index];
+  Layer* layer = edit(slot.layer);
+  Piece piece = layer->_pieces[slot.index];
+  const palette_index_t previous = piece.colorIndex();
+
+  layer->recolor(slot.index, color);
+  piece.dye(color);
+
+  _journal.record({ ChangeType::Recolored, slot.layer, handle, piece, coord2d_t(0, 0), previous });
+  ++_revision;
+}
+
+std::vector<PieceHandle> nb::Model::apply(const EditBatch& batch, std::vector<bool>* moved)
+{
+  std::vector<PieceHandle> handles(batch._insertions.size());
+  if (moved)
+    moved->assign(batch._movements.size(), false);
+
+  if (batch.empty())
+    return handles;
+
+  /* insertions are grouped by layer so that each layer storage grows once */
+  std::vector<uint32_t> order(batch._insertions.size());
+  for (uint32_t i = 0; i < order.size(); ++i)
+    order[i] = i;
+  std::stable_sort(order.begin(), order.end(), [&batch](uint32_t a, uint32_t b) { return batch._insertions[a].layer < batch._insertions[b].layer; });
+
+  struct Group
+  {
+    layer_id_t layer;
+    size_t begin, end;
+  };
+
+  std::vector<Group> groups;
+  for (size_t i = 0; i < order.size(); )
+  {
+    layer_index_t index = batch._insertions[order[i]].layer;
+    size_t end = i;
+    while (end < order.size() && batch._insertions[order[end]].layer == index)
+      ++end;
+
+    layer_id_t id = _order.at(index);
+    if (id != LayerOrder::NIL)
+      groups.push_back({ id, i, end });
+
+    i = end;
+  }
+
+  /* count edits per layer to decide whether each layer updates its index incrementally or rebuilds it afterwards */
+  std::vector<size_t> edits(_layers.size(), 0);
+
+  for (PieceHandle handle : batch._removals)
+    if (valid(handle))
+      ++edits[_slots[handle.index].layer];
+  for (const auto& movement : batch._movements)
+    if (valid(movement.handle))
+      ++edits[_slots[movement.handle.index].layer];
+  for (const auto& group : groups)
+    edits[group.layer] += group.end - group.begin;
+
+  std::vector<layer_id_t> rebuilt;
+
+  for (layer_id_t id = 0; id < _layers.size(); ++id)
+  {
+    if (!edits[id])
+      continue;
+
+    Layer* layer = edit(id);
+    if (edits[id] * BULK_EDIT_RATIO >= layer->_pieces.size())
     {
-      switch (direction)
-      {
-        case Direction::North: piece.moveBy(+0, -1); break;
-        case Direction::East: piece.moveBy(+1, 0); break;
-        case Direction::South: piece.moveBy(0, +1); break;
-        case Direction::West: piece.moveBy(-1, 0); break;
-      }
+      layer->invalidate();
+      rebuilt.push_back(id);
     }
-}
\ No newline at end of file
+    else
+      layer->reindex();
+  }
+
+  for (PieceHandle handle : batch._removals)
+    if (valid(handle))
+      erase(handle);
+
+  for (size_t i = 0; i < batch._movements.size(); ++i)
+  {
+    const auto& movement = batch._movements[i];
+    if (valid(movement.handle) && displace(movement.handle, movement.delta) && moved)
+      (*moved)[i] = true;
+  }
+
+  for (const auto& group : groups)
+  {
+    Layer* layer = _layers[group.layer].get();
+    layer->_pieces.reserve(layer->_pieces.size() + (group.end - group.begin));
+    layer->_slots.reserve(layer->_slots.size() + (group.end - group.begin));
+
+    for (size_t i = group.begin; i < group.end; ++i)
+      handles[order[i]] = insert(layer, batch._insertions[order[i]].piece);
+  }
+
+  for (layer_id_t id : rebuilt)
+    _layers[id]->reindex();
+
+  ++_revision;
+  return handles;
+}
+
+bool nb::Model::shift(Direction direction)
+{
+  switch (direction)
+  {
+    case Direction::North: return shift(coord2d_t(+0, -1));
+    case Direction::East: return shift(coord2d_t(+1, 0));
+    case Direction::South: return shift(coord2d_t(0, +1));
+    case Direction::West: return shift(coord2d_t(-1, 0));
+  }
+
+  return false;
+}
+
+bool nb::Model::shift(coord2d_t delta)
+{
+  /* pieces must keep fitting in 16 bit coordinates in world space, which is also where bake moves them */
+  const bounds2d_t area = bounds();
+  if (!area.empty() && !Piece::fits(area.translated(delta)))
+    return false;
+
+  _origin += delta;
+  ++_revision;
+  return true;
+}
+
+bool nb::Model::bake()
+{
+  if (_origin.x == 0 && _origin.y == 0)
+    return true;
+
+  const bounds2d_t area = bounds();
+  if (!area.empty() && !Piece::fits(area))
+    return false;
+
+  for (layer_id_t id = 0; id < _layers.size(); ++id)
+    if (_layers[id])
+      edit(id)->translate(_origin.x, _origin.y);
+
+  _bounds = _bounds.translated(_origin);
+  _origin = coord2d_t(0, 0);
+
+  _journal.discard();
+  ++_revision;
+  return true;
+}
+
+bounds2d_t nb::Model::bounds() const
+{
+  if (_boundsDirty)
+  {
+    _bounds = bounds2d_t();
+    for (const auto& layer : _layers)
+      if (layer)
+        _bounds.merge(layer->bounds());
+    _boundsDirty = false;
+  }
+
+  return _bounds.translated(_origin);
+}
+
+ModelSnapshot nb::Model::snapshot() const
+{
+  ModelSnapshot snapshot;
+  snapshot._info = _info;
+  snapshot._origin = _origin;
+  snapshot._revision = _revision;
+  snapshot._layers.reserve(_order.size());
+
+  _order.each([this, &snapshot](layer_index_t, layer_id_t id) {
+    const auto& layer = _layers[id];
+
+    /* lazily computed data is filled now so that readers of the snapshot never write to a shared layer */
+    for (const auto& entry : layer->occupancy().chunks())
+      entry.second.bounds();
+    layer->bounds();
+
+    snapshot._layers.push_back(layer);
+  });
+
+  return snapshot;
+}
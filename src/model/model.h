@@ -1,36 +1,66 @@
 #pragma once
 
 #include "piece.h"
+#include "storage.h"
+#include "occupancy.h"
+#include "batch.h"
+#include "journal.h"
+#include "order.h"
 
 #include <vector>
 #include <memory>
+#include <optional>
 
 namespace nb
 {
   class Model;
+  class Connectivity;
 
   class Layer
   {
   protected:
-    layer_index_t _index;
-    std::vector<Piece> _pieces;
-    Layer* _prev;
-    Layer* _next;
+    layer_id_t _id;
+    PieceStorage _pieces;
+    std::vector<uint32_t> _slots;
+    mutable OccupancyIndex _occupancy;
+    mutable bool _indexed;
+    mutable bounds2d_t _bounds;
+    mutable bool _boundsDirty;
+    /* changed on every change to the pieces of the layer, it's unique among all layers of all models so that
+       id and version together tell whether the pieces are the ones seen before, copies keep it along with the pieces */
+    uint64_t _version;
+
+    void add(const Piece& piece, uint32_t slot);
+    void remove(size_t index);
+    /* fails without changes if the piece would overlap another one */
+    bool move(size_t index, coord2d_t delta);
+    void recolor(size_t index, const PieceColor* color);
+    void translate(coord_t dx, coord_t dy);
+    void reindex() const;
+    /* drops the occupancy index, it's rebuilt lazily on next lookup */
+    void invalidate();
+
+    size_t find(const coord2d_t& coord) const;
 
   public:
-    Layer(layer_index_t index) : _index(index), _prev(nullptr), _next(nullptr) { }
-    Layer() : _index(0), _prev(nullptr), _next(nullptr) { }
+    Layer(layer_id_t id) : _id(id), _indexed(true), _boundsDirty(false), _version(0) { }
+    Layer() : Layer(0) { }
 
-    void add(const Piece& piece) { _pieces.push_back(piece); }
-    Piece* piece(const coord2d_t& coord) const;
+    std::optional<Piece> piece(const coord2d_t& coord) const;
 
-    layer_index_t index() const { return _index; }
+    /* identity of the layer, it doesn't change when layers are inserted, removed or reordered */
+    layer_id_t id() const { return _id; }
+    uint64_t version() const { return _version; }
     const auto& pieces() const { return _pieces; }
-    auto& pieces() { return _pieces; }
+    const OccupancyIndex& occupancy() const { reindex(); return _occupancy; }
+    /* bounds of the pieces in layer space */
+    const bounds2d_t& bounds() const;
 
-    const Layer* prev() const { return _prev; }
+    /* calls f(index) once for every piece which intersects area, in layer space */
+    template<typename F> void query(const bounds2d_t& area, F&& f) const;
 
     friend class nb::Model;
+    friend class nb::Connectivity;
   };
 
   struct ModelInfo
@@ -38,41 +68,220 @@ namespace nb
     std::string name;
   };
 
+  /* immutable state of a model at some point in time, layers are shared with the model until it modifies them
+     so taking one costs a reference per layer, they're stored from bottom to top and can be read from any thread */
+  class ModelSnapshot
+  {
+  protected:
+    ModelInfo _info;
+    std::vector<std::shared_ptr<const Layer>> _layers;
+    coord2d_t _origin;
+    uint64_t _revision;
+
+  public:
+    ModelSnapshot() : _revision(0) { }
+
+    const auto& info() const { return _info; }
+    const auto& layers() const { return _layers; }
+    const Layer* layer(layer_index_t index) const { return (index < _layers.size()) ? _layers[index].get() : nullptr; }
+    layer_index_t layerCount() const { return static_cast<layer_index_t>(_layers.size()); }
+
+    coord2d_t origin() const { return _origin; }
+    uint64_t revision() const { return _revision; }
+
+    friend class Model;
+  };
+
   class Model
   {
   protected:
+    static constexpr layer_id_t NO_LAYER = LayerOrder::NIL;
+
+    struct PieceSlot
+    {
+      layer_id_t layer;
+      uint32_t index;
+      uint32_t generation;
+    };
+
     ModelInfo _info;
-    std::vector<std::unique_ptr<Layer>> _layers;
+    /* layers indexed by id, null once removed, they're shared with snapshots and copied on first modification */
+    std::vector<std::shared_ptr<Layer>> _layers;
+    /* position of each layer from bottom to top */
+    LayerOrder _order;
+
+    /* translation applied to all pieces, layers store coordinates relative to it */
+    coord2d_t _origin;
+
+    /* union of layer bounds, in layer space */
+    mutable bounds2d_t _bounds;
+    mutable bool _boundsDirty;
+
+    std::vector<PieceSlot> _slots;
+    std::vector<uint32_t> _freeSlots;
+
+    /* incremented once for every edit or batch of edits */
+    uint64_t _revision;
+    Journal _journal;
+
+    /* layer which can be modified, it's copied first if a snapshot still refers to it */
+    Layer* edit(layer_id_t id);
+    layer_id_t createLayer(layer_index_t position);
 
-    void linkLayers(Layer* prev, Layer* next);
+    /* both fail without changes if the piece would leave the range of 16 bit coordinates or overlap another piece */
+    PieceHandle insert(Layer* layer, const Piece& piece);
+    void erase(PieceHandle handle);
+    bool displace(PieceHandle handle, coord2d_t delta);
 
   public:
-    Model(const std::string& name = "") { _info.name = name; }
+    /* a layer which receives at least 1/BULK_EDIT_RATIO of its size in edits from a batch drops its index for the
+       removals and rebuilds it once, before its first insertion or movement, which need it to reject overlaps, or at the end */
+    static constexpr size_t BULK_EDIT_RATIO = 4;
 
-    void addLayer(layer_index_t index);
+    Model(const std::string& name = "") : _boundsDirty(false), _revision(0) { _info.name = name; }
+
+    layer_id_t addLayer(layer_index_t index);
+    void removeLayer(layer_index_t index);
+    void moveLayer(layer_index_t from, layer_index_t to);
+    /* copies a layer with all its pieces right above it */
+    layer_id_t duplicateLayer(layer_index_t index);
+    /* replaces all layers with count empty ones, handles and ids of the previous layers stay invalid */
     void prepareLayers(layer_index_t count);
-    void addPiece(layer_index_t layerIndex, const Piece& piece);
+    PieceHandle addPiece(layer_index_t layerIndex, const Piece& piece);
 
-    void addLayerOnTop() { addLayer(static_cast<layer_index_t>(_layers.size())); }
+    void addLayerOnTop() { addLayer(layerCount()); }
     void addLayerAtBottom() { addLayer(0); }
     
-    Layer* layer(layer_index_t index) { return (index < _layers.size()) ? _layers[index].get() : nullptr; }
-    const Layer* layer(layer_index_t index) const { return (index < _layers.size()) ? _layers[index].get() : nullptr; }
+    const Layer* layer(layer_index_t index) const
+    {
+      layer_id_t id = _order.at(index);
+      return id != LayerOrder::NIL ? _layers[id].get() : nullptr;
+    }
 
-    void shift(Direction direction);
-    
-    const auto& layers() const { return _layers; }
+    const Layer* layerById(layer_id_t id) const { return id < _layers.size() ? _layers[id].get() : nullptr; }
+    layer_index_t position(layer_id_t id) const { return _order.position(id); }
+
+    /* calls f(index, layer) for every layer from bottom to top */
+    template<typename F> void eachLayer(F&& f) const
+    {
+      _order.each([this, &f](layer_index_t index, layer_id_t id) { f(index, static_cast<const Layer*>(_layers[id].get())); });
+    }
+
+    /* shifts and bakes are refused if any piece would leave the range of 16 bit coordinates */
+    bool shift(Direction direction);
+    bool shift(coord2d_t delta);
+    bool bake();
+
+    coord2d_t origin() const { return _origin; }
+    bounds2d_t bounds() const;
     
     auto& info() { return _info; }
     const auto& info() const { return _info; }
 
-    layer_index_t lastLayerIndex() const { return static_cast<layer_index_t>(_layers.size()) - 1; }
-    layer_index_t layerCount() const { return static_cast<layer_index_t>(_layers.size()); }
+    layer_index_t lastLayerIndex() const { return _order.size() - 1; }
+    layer_index_t layerCount() const { return _order.size(); }
+
+    std::optional<Piece> piece(const coord3d_t& coord) const;
+    PieceHandle handle(const coord3d_t& coord) const;
+    /* calls f(record, handle) for every piece which intersects box, with the record in world space,
+       the cost depends on the pieces and chunks inside box rather than on the size of the model */
+    template<typename F> void query(const bounds3d_t& box, F&& f) const;
+
+    bool valid(PieceHandle handle) const { return handle.index < _slots.size() && _slots[handle.index].generation == handle.generation && _slots[handle.index].layer != NO_LAYER; }
+    std::optional<Piece> piece(PieceHandle handle) const;
+    /* piece together with its layer in world space */
+    std::optional<PieceRecord> record(PieceHandle handle) const;
+    void remove(PieceHandle handle);
+    bool move(PieceHandle handle, coord2d_t delta);
+    void recolor(PieceHandle handle, const PieceColor* color);
+
+    /* applies removals, then movements, then insertions of the batch in a single pass,
+       returns the handles of the inserted pieces in the order they were added to the batch, invalid for the rejected ones,
+       moved, if given, receives for every movement of the batch whether it was applied */
+    std::vector<PieceHandle> apply(const EditBatch& batch, std::vector<bool>* moved = nullptr);
 
-    Piece* piece(const coord3d_t& coord) const;
-    void remove(const Piece* piece);
+    uint64_t revision() const { return _revision; }
+    const Journal& journal() const { return _journal; }
+
+    ModelSnapshot snapshot() const;
+
+    friend class nb::Connectivity;
   };
 
+  template<typename F>
+  void Layer::query(const bounds2d_t& area, F&& f) const
+  {
+    const bounds2d_t clipped = area.intersection(bounds());
+    if (clipped.empty())
+      return;
+
+    const OccupancyIndex& occupancy = this->occupancy();
+
+    auto visit = [this, &clipped, &f](const Chunk& chunk, coord_t cx, coord_t cy) {
+      for (piece_index_t index : chunk.pieces)
+      {
+        const bounds2d_t bounds = _pieces[index].bounds();
+        if (!bounds.intersects(clipped))
+          continue;
+
+        /* a piece spanning many chunks is reported only by the chunk holding the first cell of its overlap with area */
+        const bounds2d_t overlap = bounds.intersection(clipped);
+        if (OccupancyIndex::chunkOf(overlap.min.x) == cx && OccupancyIndex::chunkOf(overlap.min.y) == cy)
+          f(static_cast<size_t>(index));
+      }
+    };
+
+    const uint64_t columns = uint64_t(OccupancyIndex::chunkOf(clipped.max.x - 1) - OccupancyIndex::chunkOf(clipped.min.x) + 1);
+    const uint64_t rows = uint64_t(OccupancyIndex::chunkOf(clipped.max.y - 1) - OccupancyIndex::chunkOf(clipped.min.y) + 1);
+
+    /* large areas over sparse layers go through the existing chunks instead of the chunks covered by the area */
+    if (columns * rows > occupancy.size())
+    {
+      const bounds2d_t range = bounds2d_t(
+        coord2d_t(OccupancyIndex::chunkOf(clipped.min.x), OccupancyIndex::chunkOf(clipped.min.y)),
+        coord2d_t(OccupancyIndex::chunkOf(clipped.max.x - 1) + 1, OccupancyIndex::chunkOf(clipped.max.y - 1) + 1)
+      );
+
+      for (const auto& entry : occupancy.chunks())
+      {
+        const coord2d_t chunk = coord2d_t(OccupancyIndex::chunkOf(entry.second.origin.x), OccupancyIndex::chunkOf(entry.second.origin.y));
+        if (range.contains(chunk))
+          visit(entry.second, chunk.x, chunk.y);
+      }
+    }
+    else
+    {
+      OccupancyIndex::spans(clipped, [&occupancy, &visit](coord_t cx, coord_t cy, coord_t, coord_t, coord_t, coord_t) {
+        if (const Chunk* chunk = occupancy.chunk(cx, cy))
+          visit(*chunk, cx, cy);
+        return false;
+      });
+    }
+  }
+
+  template<typename F>
+  void Model::query(const bounds3d_t& box, F&& f) const
+  {
+    if (box.empty())
+      return;
+
+    const bounds2d_t area = box.area.translated(coord2d_t(-_origin.x, -_origin.y));
+    const layer_index_t bottom = std::max(box.bottom, 0), top = std::min(box.top, layerCount());
+
+    for (layer_index_t position = bottom; position < top; ++position)
+    {
+      const Layer* layer = this->layer(position);
+
+      layer->query(area, [this, layer, position, &f](size_t index) {
+        Piece piece = layer->_pieces[index];
+        piece.moveBy(_origin);
+
+        const uint32_t slot = layer->_slots[index];
+        f(PieceRecord{ position, piece }, PieceHandle(slot, _slots[slot].generation));
+      });
+    }
+  }
+
   struct layer_iterator_t
   {
   protected:
@@ -0,0 +1,178 @@
+#include "occupancy.h"
+
+#include "piece.h"
+
+#include <bit>
+
+using namespace nb;
+
+nb::Chunk::Chunk(coord2d_t origin) : origin(origin), occupied(0), version(0), _dirty(false)
+{
+  cells.fill(OccupancyIndex::INVALID);
+  rows.fill(0);
+}
+
+const bounds2d_t& nb::Chunk::bounds() const
+{
+  if (_dirty)
+  {
+    uint32_t columns = 0;
+    coord_t minY = SIZE, maxY = -1;
+
+    for (coord_t y = 0; y < SIZE; ++y)
+    {
+      if (rows[y])
+      {
+        columns |= rows[y];
+        minY = std::min(minY, y);
+        maxY = y;
+      }
+    }
+
+    if (columns)
+      _bounds = bounds2d_t(
+        coord2d_t(origin.x + std::countr_zero(columns), origin.y + minY),
+        coord2d_t(origin.x + SIZE - std::countl_zero(columns), origin.y + maxY + 1)
+      );
+    else
+      _bounds = bounds2d_t();
+
+    _dirty = false;
+  }
+
+  return _bounds;
+}
+
+/* calls f(chunk, x0, x1, y0, y1) with the area covered by the piece in each chunk it touches, in chunk space */
+template<typename F>
+void nb::OccupancyIndex::forEachSpan(const Piece& piece, F&& f)
+{
+  ++_version;
+
+  spans(piece.bounds(), [this, &f](coord_t cx, coord_t cy, coord_t x0, coord_t x1, coord_t y0, coord_t y1) {
+    auto it = _chunks.try_emplace(key(cx, cy), coord2d_t(cx * Chunk::SIZE, cy * Chunk::SIZE)).first;
+    Chunk& chunk = it->second;
+
+    f(chunk, x0, x1, y0, y1);
+
+    chunk._dirty = true;
+    chunk.version = _version;
+
+    if (!chunk.occupied && chunk.pieces.empty())
+      _chunks.erase(it);
+
+    return false;
+  });
+}
+
+piece_index_t nb::OccupancyIndex::at(const coord2d_t& coord) const
+{
+  const Chunk* chunk = this->chunk(chunkOf(coord.x), chunkOf(coord.y));
+  return chunk ? chunk->at(coord.x & Chunk::MASK, coord.y & Chunk::MASK) : INVALID;
+}
+
+bool nb::OccupancyIndex::intersects(const bounds2d_t& area) const
+{
+  return spans(area, [this](coord_t cx, coord_t cy, coord_t x0, coord_t x1, coord_t y0, coord_t y1) {
+    const Chunk* chunk = this->chunk(cx, cy);
+    if (chunk)
+    {
+      const uint32_t mask = Chunk::spanMask(x0, x1);
+      for (coord_t y = y0; y < y1; ++y)
+        if (chunk->rows[y] & mask)
+          return true;
+    }
+
+    return false;
+  });
+}
+
+size_t nb::OccupancyIndex::count(const bounds2d_t& area) const
+{
+  size_t result = 0;
+
+  spans(area, [this, &result](coord_t cx, coord_t cy, coord_t x0, coord_t x1, coord_t y0, coord_t y1) {
+    const Chunk* chunk = this->chunk(cx, cy);
+    if (chunk)
+    {
+      const uint32_t mask = Chunk::spanMask(x0, x1);
+      for (coord_t y = y0; y < y1; ++y)
+        result += std::popcount(chunk->rows[y] & mask);
+    }
+
+    return false;
+  });
+
+  return result;
+}
+
+bool nb::OccupancyIndex::covers(const bounds2d_t& area) const
+{
+  /* spans stops at the first chunk with a free cell */
+  return !area.empty() && !spans(area, [this](coord_t cx, coord_t cy, coord_t x0, coord_t x1, coord_t y0, coord_t y1) {
+    const Chunk* chunk = this->chunk(cx, cy);
+    if (!chunk)
+      return true;
+
+    const uint32_t mask = Chunk::spanMask(x0, x1);
+    for (coord_t y = y0; y < y1; ++y)
+      if ((chunk->rows[y] & mask) != mask)
+        return true;
+
+    return false;
+  });
+}
+
+void nb::OccupancyIndex::mark(const Piece& piece, piece_index_t index)
+{
+  forEachSpan(piece, [index](Chunk& chunk, coord_t x0, coord_t x1, coord_t y0, coord_t y1) {
+    const uint32_t mask = Chunk::spanMask(x0, x1);
+    for (coord_t y = y0; y < y1; ++y)
+    {
+      chunk.occupied += std::popcount(mask & ~chunk.rows[y]);
+      chunk.rows[y] |= mask;
+      std::fill_n(chunk.cells.begin() + y * Chunk::SIZE + x0, x1 - x0, index);
+    }
+
+    chunk.pieces.push_back(index);
+  });
+}
+
+void nb::OccupancyIndex::unmark(const Piece& piece, piece_index_t index)
+{
+  forEachSpan(piece, [index](Chunk& chunk, coord_t x0, coord_t x1, coord_t y0, coord_t y1) {
+    for (coord_t y = y0; y < y1; ++y)
+      for (coord_t x = x0; x < x1; ++x)
+      {
+        auto& cell = chunk.cells[y * Chunk::SIZE + x];
+        if (cell == index)
+        {
+          cell = INVALID;
+          chunk.rows[y] &= ~(uint32_t(1) << x);
+          --chunk.occupied;
+        }
+      }
+
+    auto it = std::find(chunk.pieces.begin(), chunk.pieces.end(), index);
+    if (it != chunk.pieces.end())
+    {
+      *it = chunk.pieces.back();
+      chunk.pieces.pop_back();
+    }
+  });
+}
+
+void nb::OccupancyIndex::relink(const Piece& piece, piece_index_t from, piece_index_t to)
+{
+  forEachSpan(piece, [from, to](Chunk& chunk, coord_t x0, coord_t x1, coord_t y0, coord_t y1) {
+    for (coord_t y = y0; y < y1; ++y)
+      for (coord_t x = x0; x < x1; ++x)
+      {
+        auto& cell = chunk.cells[y * Chunk::SIZE + x];
+        if (cell == from)
+          cell = to;
+      }
+
+    std::replace(chunk.pieces.begin(), chunk.pieces.end(), from, to);
+  });
+}
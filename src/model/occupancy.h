@@ -0,0 +1,118 @@
+#pragma once
+
+#include "common.h"
+
+#include <array>
+#include <vector>
+#include <unordered_map>
+
+namespace nb
+{
+  class Piece;
+
+  using piece_index_t = uint32_t;
+
+  /* square area of a layer, keeps which piece covers every cell together with
+     a bitmap of occupied cells and the list of pieces that touch it */
+  struct Chunk
+  {
+    static constexpr coord_t SHIFT = 5;
+    static constexpr coord_t SIZE = 1 << SHIFT;
+    static constexpr coord_t MASK = SIZE - 1;
+
+    coord2d_t origin;
+    std::array<piece_index_t, SIZE * SIZE> cells;
+    std::array<uint32_t, SIZE> rows;
+    std::vector<piece_index_t> pieces;
+    uint32_t occupied;
+    /* version of the index when the chunk was last modified */
+    uint64_t version;
+
+    Chunk(coord2d_t origin);
+
+    piece_index_t at(coord_t lx, coord_t ly) const { return cells[ly * SIZE + lx]; }
+    const bounds2d_t& bounds() const;
+
+    /* bitmask of the columns in [from, to) of a row */
+    static uint32_t spanMask(coord_t from, coord_t to)
+    {
+      const coord_t length = to - from;
+      return (length >= SIZE ? ~uint32_t(0) : ((uint32_t(1) << length) - 1)) << from;
+    }
+
+  protected:
+    mutable bounds2d_t _bounds;
+    mutable bool _dirty;
+
+    friend class OccupancyIndex;
+  };
+
+  /* sparse map of chunks for a layer which maps every covered cell to the index of the piece covering it,
+     chunks are allocated only where pieces exist so that empty space doesn't cost memory */
+  class OccupancyIndex
+  {
+  public:
+    static constexpr piece_index_t INVALID = ~piece_index_t(0);
+
+  protected:
+    std::unordered_map<uint64_t, Chunk> _chunks;
+    /* incremented on every modification, it's not reset by clear so it's monotonic for the whole lifetime of the index */
+    uint64_t _version;
+
+    template<typename F> void forEachSpan(const Piece& piece, F&& f);
+
+  public:
+    OccupancyIndex() : _version(0) { }
+
+    static coord_t chunkOf(coord_t c) { return c >> Chunk::SHIFT; }
+    static uint64_t key(coord_t cx, coord_t cy) { return (uint64_t(uint32_t(cx)) << 32) | uint32_t(cy); }
+
+    /* calls f(cx, cy, x0, x1, y0, y1) for every chunk touched by area with the covered part in chunk space,
+       iteration stops as soon as f returns true */
+    template<typename F> static bool spans(const bounds2d_t& area, F&& f)
+    {
+      if (area.empty())
+        return false;
+
+      for (coord_t cy = chunkOf(area.min.y); cy <= chunkOf(area.max.y - 1); ++cy)
+      {
+        for (coord_t cx = chunkOf(area.min.x); cx <= chunkOf(area.max.x - 1); ++cx)
+        {
+          const coord_t ox = cx * Chunk::SIZE, oy = cy * Chunk::SIZE;
+          if (f(cx, cy,
+            std::max(area.min.x, ox) - ox, std::min(area.max.x, ox + Chunk::SIZE) - ox,
+            std::max(area.min.y, oy) - oy, std::min(area.max.y, oy + Chunk::SIZE) - oy))
+            return true;
+        }
+      }
+
+      return false;
+    }
+
+    piece_index_t at(const coord2d_t& coord) const;
+    /* true if any cell inside area is occupied */
+    bool intersects(const bounds2d_t& area) const;
+    /* number of occupied cells inside area */
+    size_t count(const bounds2d_t& area) const;
+    /* true if every cell inside a non empty area is occupied */
+    bool covers(const bounds2d_t& area) const;
+
+    void mark(const Piece& piece, piece_index_t index);
+    void unmark(const Piece& piece, piece_index_t index);
+    /* updates references to a piece whose index changed */
+    void relink(const Piece& piece, piece_index_t from, piece_index_t to);
+
+    const Chunk* chunk(coord_t cx, coord_t cy) const
+    {
+      auto it = _chunks.find(key(cx, cy));
+      return it != _chunks.end() ? &it->second : nullptr;
+    }
+
+    const auto& chunks() const { return _chunks; }
+
+    uint64_t version() const { return _version; }
+
+    void clear() { _chunks.clear(); ++_version; }
+    size_t size() const { return _chunks.size(); }
+  };
+}
@@ -0,0 +1,127 @@
+#include "order.h"
+
+using namespace nb;
+
+void nb::LayerOrder::update(layer_id_t node)
+{
+  Node& n = _nodes[node];
+  n.size = 1 + size(n.left) + size(n.right);
+
+  if (n.left != NIL)
+    _nodes[n.left].parent = node;
+  if (n.right != NIL)
+    _nodes[n.right].parent = node;
+}
+
+void nb::LayerOrder::split(layer_id_t tree, uint32_t count, layer_id_t& left, layer_id_t& right)
+{
+  if (tree == NIL)
+  {
+    left = right = NIL;
+    return;
+  }
+
+  Node& n = _nodes[tree];
+  if (size(n.left) < count)
+  {
+    split(n.right, count - size(n.left) - 1, n.right, right);
+    left = tree;
+  }
+  else
+  {
+    split(n.left, count, left, n.left);
+    right = tree;
+  }
+
+  update(tree);
+}
+
+layer_id_t nb::LayerOrder::merge(layer_id_t left, layer_id_t right)
+{
+  if (left == NIL)
+    return right;
+  else if (right == NIL)
+    return left;
+
+  if (_nodes[left].priority > _nodes[right].priority)
+  {
+    _nodes[left].right = merge(_nodes[left].right, right);
+    update(left);
+    return left;
+  }
+  else
+  {
+    _nodes[right].left = merge(left, _nodes[right].left);
+    update(right);
+    return right;
+  }
+}
+
+void nb::LayerOrder::insert(layer_id_t id, layer_index_t position)
+{
+  if (id >= _nodes.size())
+    _nodes.resize(id + 1);
+
+  /* priority only needs to look random, a hash of the id keeps the tree deterministic */
+  uint32_t hash = id * 0x9E3779B9u;
+  hash ^= hash >> 16;
+  hash *= 0x85EBCA6Bu;
+  hash ^= hash >> 13;
+
+  _nodes[id] = { NIL, NIL, NIL, 1, hash };
+
+  layer_id_t left, right;
+  split(_root, static_cast<uint32_t>(std::clamp(position, 0, size())), left, right);
+  _root = merge(merge(left, id), right);
+  _nodes[_root].parent = NIL;
+}
+
+void nb::LayerOrder::erase(layer_id_t id)
+{
+  layer_id_t left, middle, right;
+  const uint32_t position = static_cast<uint32_t>(this->position(id));
+
+  split(_root, position, left, middle);
+  split(middle, 1, middle, right);
+  _root = merge(left, right);
+
+  if (_root != NIL)
+    _nodes[_root].parent = NIL;
+}
+
+layer_id_t nb::LayerOrder::at(layer_index_t position) const
+{
+  if (position < 0 || position >= size())
+    return NIL;
+
+  layer_id_t node = _root;
+  uint32_t remaining = static_cast<uint32_t>(position);
+
+  while (true)
+  {
+    const Node& n = _nodes[node];
+    if (remaining < size(n.left))
+      node = n.left;
+    else if (remaining == size(n.left))
+      return node;
+    else
+    {
+      remaining -= size(n.left) + 1;
+      node = n.right;
+    }
+  }
+}
+
+layer_index_t nb::LayerOrder::position(layer_id_t id) const
+{
+  uint32_t position = size(_nodes[id].left);
+
+  for (layer_id_t node = id; _nodes[node].parent != NIL; node = _nodes[node].parent)
+  {
+    const Node& parent = _nodes[_nodes[node].parent];
+    if (parent.right == node)
+      position += size(parent.left) + 1;
+  }
+
+  return static_cast<layer_index_t>(position);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "common.h"
+
+#include <vector>
+
+namespace nb
+{
+  /* sequence of layer ids kept as an implicit treap, each node knows the size of its subtree so
+     the id at a position and the position of an id are both found in O(log n), as are insertions and removals */
+  class LayerOrder
+  {
+  public:
+    static constexpr layer_id_t NIL = ~layer_id_t(0);
+
+  protected:
+    struct Node
+    {
+      layer_id_t left;
+      layer_id_t right;
+      layer_id_t parent;
+      uint32_t size;
+      uint32_t priority;
+    };
+
+    /* nodes are indexed by layer id */
+    std::vector<Node> _nodes;
+    layer_id_t _root;
+
+    uint32_t size(layer_id_t node) const { return node != NIL ? _nodes[node].size : 0; }
+    void update(layer_id_t node);
+
+    /* splits tree in the first count nodes and the rest */
+    void split(layer_id_t tree, uint32_t count, layer_id_t& left, layer_id_t& right);
+    layer_id_t merge(layer_id_t left, layer_id_t right);
+
+    template<typename F> void visit(layer_id_t node, layer_index_t& position, F& f) const
+    {
+      if (node == NIL)
+        return;
+
+      visit(_nodes[node].left, position, f);
+      f(position++, node);
+      visit(_nodes[node].right, position, f);
+    }
+
+  public:
+    LayerOrder() : _root(NIL) { }
+
+    void insert(layer_id_t id, layer_index_t position);
+    void erase(layer_id_t id);
+
+    layer_id_t at(layer_index_t position) const;
+    layer_index_t position(layer_id_t id) const;
+
+    /* calls f(position, id) for every layer from bottom to top */
+    template<typename F> void each(F&& f) const
+    {
+      layer_index_t position = 0;
+      visit(_root, position, f);
+    }
+
+    layer_index_t size() const { return static_cast<layer_index_t>(size(_root)); }
+    void clear() { _nodes.clear(); _root = NIL; }
+  };
+}
@@ -2,6 +2,9 @@
 
 #include <cstdint>
 #include <array>
+#include <vector>
+#include <utility>
+#include <limits>
 
 #include "common.h"
 #include "defines.h"
@@ -28,13 +31,16 @@ namespace nb
     Full
   };
 
+  using palette_index_t = uint8_t;
+
   struct PieceColor
   {
     ident_t ident;
     std::array<raylib::Color, 4> colors;
+    palette_index_t index;
 
-    PieceColor() { }
-    PieceColor(const ident_t& ident, const std::array<raylib::Color, 4>& cols) : ident(ident), colors(cols) { }
+    PieceColor() : index(0xFF) { }
+    PieceColor(const ident_t& ident, const std::array<raylib::Color, 4>& cols) : ident(ident), colors(cols), index(0xFF) { }
 
     const raylib::Color& top() const { return colors[0]; }
     const raylib::Color& left() const { return colors[1]; }
@@ -46,55 +52,152 @@ namespace nb
     Vector3 rightV() const { return Vector3{ right().r / 255.0f, right().g / 255.0f, right().b / 255.0f }; }
   };
 
+  /* registry of all the colors known to the application, pieces refer to colors by their index in here */
+  class Palette
+  {
+  protected:
+    std::vector<const PieceColor*> _colors;
+
+  public:
+    static constexpr palette_index_t NONE = 0xFF;
+
+    /* NONE is never handed out, colors past the last index are rejected and get NONE as index */
+    palette_index_t add(PieceColor* color)
+    {
+      if (_colors.size() >= NONE)
+      {
+        color->index = NONE;
+        return NONE;
+      }
+
+      color->index = static_cast<palette_index_t>(_colors.size());
+      _colors.push_back(color);
+      return color->index;
+    }
+
+    const PieceColor* operator[](palette_index_t index) const { return index < _colors.size() ? _colors[index] : nullptr; }
+    size_t size() const { return _colors.size(); }
+
+    static Palette& global()
+    {
+      static Palette palette;
+      return palette;
+    }
+  };
+
   using piece_type_t = std::string;
 
+  /* storage form of a piece as kept by the model */
+  struct PackedPiece
+  {
+    int16_t x;
+    int16_t y;
+    uint8_t width;
+    uint8_t height;
+    palette_index_t color;
+    uint8_t orientation : 2;
+    uint8_t type : 1;
+    uint8_t studs : 2;
+  };
+
+  static_assert(sizeof(PackedPiece) == 8, "PackedPiece is expected to be 8 bytes");
+
   class Piece
   {
-    const PieceColor* _color;
-    PieceOrientation _orientation;
-    PieceType _type;
-    StudMode _studs;
-    coord2d_t _coord;
-    size2d_t _size;
+    PackedPiece _data;
+
+    static palette_index_t indexOf(const PieceColor* color) { return color ? color->index : Palette::NONE; }
+    static uint8_t pack(PieceOrientation orientation)
+    {
+      switch (orientation)
+      {
+        case PieceOrientation::East: return 1;
+        case PieceOrientation::South: return 2;
+        case PieceOrientation::West: return 3;
+        default: return 0;
+      }
+    }
 
   public:
-    Piece() : _coord(0, 0), _color(nullptr), _orientation(PieceOrientation::North), _size(1, 1) { }
-    Piece(coord2d_t coord, const PieceColor* color, PieceOrientation orientation, PieceType type = PieceType::Square, size2d_t size = size2d_t(1, 1), StudMode studs = StudMode::Full) :
-      _coord(coord), _color(color), _orientation(orientation), _type(type), _size(size), _studs(studs) { }
+    static constexpr int32_t MAX_SIZE = 0xFF;
+    /* every cell of a piece must lie in the range of its 16 bit coordinates */
+    static constexpr coord_t MIN_COORD = std::numeric_limits<int16_t>::min();
+    static constexpr coord_t MAX_COORD = std::numeric_limits<int16_t>::max();
+
+    static bool fits(const bounds2d_t& area) { return area.min.x >= MIN_COORD && area.min.y >= MIN_COORD && area.max.x <= MAX_COORD + 1 && area.max.y <= MAX_COORD + 1; }
+
+    Piece() : Piece(coord2d_t(0, 0), nullptr, PieceOrientation::North) { }
+    Piece(coord2d_t coord, const PieceColor* color, PieceOrientation orientation, PieceType type = PieceType::Square, size2d_t size = size2d_t(1, 1), StudMode studs = StudMode::Full)
+    {
+      moveAt(coord);
+      resize(size);
+      dye(color);
+      _data.orientation = pack(orientation);
+      _data.type = static_cast<uint8_t>(type);
+      _data.studs = static_cast<uint8_t>(studs);
+    }
+    Piece(const PackedPiece& data) : _data(data) { }
     
-    void resize(size2d_t size) { _size = size; }
-    void swapSize() { _size = size2d_t(_size.height, _size.width); }
+    void resize(size2d_t size) { _data.width = static_cast<uint8_t>(size.width); _data.height = static_cast<uint8_t>(size.height); }
+    void swapSize() { std::swap(_data.width, _data.height); }
 
-    void moveAt(coord2d_t coord) { _coord = coord; }
-    void moveBy(coord2d_t delta) { _coord += delta; }
+    void moveAt(coord2d_t coord) { _data.x = static_cast<int16_t>(coord.x); _data.y = static_cast<int16_t>(coord.y); }
+    void moveBy(coord2d_t delta) { moveAt(coord() + delta); }
 
-    void moveBy(coord_t x, coord_t y) { _coord += coord2d_t(x, y); }
+    void moveBy(coord_t x, coord_t y) { moveBy(coord2d_t(x, y)); }
 
 
-    void dye(const PieceColor* color) { _color = color; }
-    void setStuds(StudMode studs) { _studs = studs; }
+    void dye(const PieceColor* color) { _data.color = indexOf(color); }
+    void setStuds(StudMode studs) { _data.studs = static_cast<uint8_t>(studs); }
 
     Piece derive(size2d_t size) const
     {
-      Piece other;
-      other._color = _color;
-      other._orientation = _orientation;
-      other._coord = _coord;
-      other._size = size;
+      Piece other = *this;
+      other.resize(size);
       return other;
     }
 
-    coord2d_t coord() const { return _coord; }
-    coord_t x() const { return _coord.x; }
-    coord_t y() const { return _coord.y; }
-    const PieceColor* color() const { return _color; }
-    size2d_t size() const { return _size; }
-    PieceType type() const { return _type; }
-    StudMode studs() const { return _studs; }
+    const PackedPiece& data() const { return _data; }
+
+    coord2d_t coord() const { return coord2d_t(_data.x, _data.y); }
+    coord_t x() const { return _data.x; }
+    coord_t y() const { return _data.y; }
+    const PieceColor* color() const { return Palette::global()[_data.color]; }
+    palette_index_t colorIndex() const { return _data.color; }
+    size2d_t size() const { return size2d_t(_data.width, _data.height); }
+    PieceOrientation orientation() const { return static_cast<PieceOrientation>(1 << _data.orientation); }
+    PieceType type() const { return static_cast<PieceType>(_data.type); }
+    StudMode studs() const { return static_cast<StudMode>(_data.studs); }
 
-    int32_t width() const { return _size.width; }
-    int32_t height() const { return _size.height; }
+    int32_t width() const { return _data.width; }
+    int32_t height() const { return _data.height; }
+
+    bounds2d_t bounds() const { return bounds2d_t(coord(), coord() + coord2d_t(width(), height())); }
     
     
   };
+
+  /* piece together with the layer it belongs to */
+  struct PieceRecord
+  {
+    layer_index_t layer;
+    Piece piece;
+  };
+
+  /* stable reference to a piece of a model, it's invalidated when the piece is removed */
+  struct PieceHandle
+  {
+    static constexpr uint32_t INVALID = ~uint32_t(0);
+
+    uint32_t index;
+    uint32_t generation;
+
+    PieceHandle() : index(INVALID), generation(0) { }
+    PieceHandle(uint32_t index, uint32_t generation) : index(index), generation(generation) { }
+
+    bool operator==(const PieceHandle& other) const { return index == other.index && generation == other.generation; }
+    bool operator!=(const PieceHandle& other) const { return !(*this == other); }
+
+    explicit operator bool() const { return index != INVALID; }
+  };
 }
@@ -0,0 +1,118 @@
+#include "storage.h"
+
+#if defined(NB_SIMD_AVX2)
+  #include <immintrin.h>
+#elif defined(NB_SIMD_SSE2)
+  #include <emmintrin.h>
+#endif
+
+using namespace nb;
+
+void nb::PieceStorage::reserve(size_t count)
+{
+  _x.reserve(count);
+  _y.reserve(count);
+  _width.reserve(count);
+  _height.reserve(count);
+  _color.reserve(count);
+  _flags.reserve(count);
+}
+
+void nb::PieceStorage::clear()
+{
+  _x.clear();
+  _y.clear();
+  _width.clear();
+  _height.clear();
+  _color.clear();
+  _flags.clear();
+}
+
+void nb::PieceStorage::push_back(const Piece& piece)
+{
+  const PackedPiece& data = piece.data();
+  _x.push_back(data.x);
+  _y.push_back(data.y);
+  _width.push_back(data.width);
+  _height.push_back(data.height);
+  _color.push_back(data.color);
+  _flags.push_back(packFlags(data));
+}
+
+void nb::PieceStorage::set(size_t index, const Piece& piece)
+{
+  const PackedPiece& data = piece.data();
+  _x[index] = data.x;
+  _y[index] = data.y;
+  _width[index] = data.width;
+  _height[index] = data.height;
+  _color[index] = data.color;
+  _flags[index] = packFlags(data);
+}
+
+void nb::PieceStorage::swapRemove(size_t index)
+{
+  size_t last = size() - 1;
+  if (index != last)
+  {
+    _x[index] = _x[last];
+    _y[index] = _y[last];
+    _width[index] = _width[last];
+    _height[index] = _height[last];
+    _color[index] = _color[last];
+    _flags[index] = _flags[last];
+  }
+
+  _x.pop_back();
+  _y.pop_back();
+  _width.pop_back();
+  _height.pop_back();
+  _color.pop_back();
+  _flags.pop_back();
+}
+
+Piece nb::PieceStorage::operator[](size_t index) const
+{
+  PackedPiece data;
+  data.x = _x[index];
+  data.y = _y[index];
+  data.width = _width[index];
+  data.height = _height[index];
+  data.color = _color[index];
+  data.orientation = _flags[index] & 0x03;
+  data.type = (_flags[index] >> 2) & 0x01;
+  data.studs = (_flags[index] >> 3) & 0x03;
+  return Piece(data);
+}
+
+static void translateColumn(int16_t* data, size_t count, int16_t delta)
+{
+  size_t i = 0;
+
+#if defined(NB_SIMD_AVX2)
+  const __m256i d = _mm256_set1_epi16(delta);
+  for (; i + 16 <= count; i += 16)
+  {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(data + i), _mm256_add_epi16(v, d));
+  }
+#elif defined(NB_SIMD_SSE2)
+  const __m128i d = _mm_set1_epi16(delta);
+  for (; i + 8 <= count; i += 8)
+  {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), _mm_add_epi16(v, d));
+  }
+#endif
+
+  for (; i < count; ++i)
+    data[i] = static_cast<int16_t>(data[i] + delta);
+}
+
+void nb::PieceStorage::translate(coord_t dx, coord_t dy)
+{
+  if (dx)
+    translateColumn(_x.data(), _x.size(), static_cast<int16_t>(dx));
+  if (dy)
+    translateColumn(_y.data(), _y.size(), static_cast<int16_t>(dy));
+}
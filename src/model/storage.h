@@ -0,0 +1,72 @@
+#pragma once
+
+#include "piece.h"
+
+#include <vector>
+#include <iterator>
+
+namespace nb
+{
+  /* structure of arrays storage for the pieces of a layer, each field lives in its own column
+     so that bulk operations only touch the data they need and can run as SIMD loops */
+  class PieceStorage
+  {
+  protected:
+    std::vector<int16_t> _x;
+    std::vector<int16_t> _y;
+    std::vector<uint8_t> _width;
+    std::vector<uint8_t> _height;
+    std::vector<palette_index_t> _color;
+    std::vector<uint8_t> _flags;
+
+    static uint8_t packFlags(const PackedPiece& data) { return data.orientation | (data.type << 2) | (data.studs << 3); }
+
+  public:
+    static constexpr size_t NOT_FOUND = ~size_t(0);
+
+    class const_iterator
+    {
+      const PieceStorage* _storage;
+      size_t _i;
+
+    public:
+      using iterator_category = std::forward_iterator_tag;
+      using value_type = Piece;
+      using difference_type = std::ptrdiff_t;
+      using pointer = void;
+      using reference = Piece;
+
+      const_iterator(const PieceStorage* storage, size_t i) : _storage(storage), _i(i) { }
+
+      Piece operator*() const { return (*_storage)[_i]; }
+      const_iterator& operator++() { ++_i; return *this; }
+      bool operator==(const const_iterator& other) const { return _i == other._i; }
+      bool operator!=(const const_iterator& other) const { return _i != other._i; }
+    };
+
+    size_t size() const { return _x.size(); }
+    bool empty() const { return _x.empty(); }
+
+    void reserve(size_t count);
+    void clear();
+
+    void push_back(const Piece& piece);
+    void set(size_t index, const Piece& piece);
+    void swapRemove(size_t index);
+
+    Piece operator[](size_t index) const;
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, size()); }
+
+    const int16_t* xs() const { return _x.data(); }
+    const int16_t* ys() const { return _y.data(); }
+    const uint8_t* widths() const { return _width.data(); }
+    const uint8_t* heights() const { return _height.data(); }
+    const palette_index_t* colors() const { return _color.data(); }
+    const uint8_t* flags() const { return _flags.data(); }
+
+    /* moves all pieces by the given delta */
+    void translate(coord_t dx, coord_t dy);
+  };
+}
@@ -0,0 +1,93 @@
+#include "validation.h"
+
+#include "model.h"
+
+#include <bit>
+#include <numeric>
+#include <algorithm>
+#include <unordered_map>
+
+using namespace nb;
+
+bool nb::Validator::canPlace(const Model& model, layer_index_t index, const Piece& piece)
+{
+  const Layer* layer = model.layer(index);
+  if (!layer)
+    return false;
+
+  /* layers work in their own space, relative to model origin */
+  return !layer->occupancy().intersects(piece.bounds().translated(coord2d_t(-model.origin().x, -model.origin().y)));
+}
+
+namespace
+{
+  /* occupancy bitmap of a chunk which also remembers the first piece that covered each cell, the pieces
+     covering a cell after the first one are kept aside since overlaps are rare */
+  struct ChunkBits
+  {
+    std::array<uint32_t, Chunk::SIZE> rows = { };
+    std::array<uint32_t, Chunk::SIZE * Chunk::SIZE> owners;
+    std::unordered_map<uint32_t, std::vector<uint32_t>> others;
+  };
+}
+
+std::vector<Validator::Overlap> nb::Validator::validate(const std::vector<PieceRecord>& pieces)
+{
+  std::vector<Overlap> overlaps;
+
+  /* process layers one by one while keeping the original order of pieces inside each layer */
+  std::vector<uint32_t> order(pieces.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&pieces](uint32_t a, uint32_t b) { return pieces[a].layer < pieces[b].layer; });
+
+  std::unordered_map<uint64_t, ChunkBits> chunks;
+  std::vector<uint32_t> hits;
+
+  for (size_t k = 0; k < order.size(); ++k)
+  {
+    const uint32_t i = order[k];
+
+    if (k > 0 && pieces[order[k - 1]].layer != pieces[i].layer)
+      chunks.clear();
+
+    hits.clear();
+
+    auto record = [&hits](uint32_t owner) {
+      if (std::find(hits.begin(), hits.end(), owner) == hits.end())
+        hits.push_back(owner);
+    };
+
+    OccupancyIndex::spans(pieces[i].piece.bounds(), [&](coord_t cx, coord_t cy, coord_t x0, coord_t x1, coord_t y0, coord_t y1) {
+      ChunkBits& bits = chunks[OccupancyIndex::key(cx, cy)];
+      const uint32_t mask = Chunk::spanMask(x0, x1);
+
+      for (coord_t y = y0; y < y1; ++y)
+      {
+        /* cells already covered tell which pieces we overlap, cells still free get the current piece as owner */
+        for (uint32_t hit = bits.rows[y] & mask; hit; hit &= hit - 1)
+        {
+          const uint32_t cell = y * Chunk::SIZE + std::countr_zero(hit);
+
+          record(bits.owners[cell]);
+
+          std::vector<uint32_t>& others = bits.others[cell];
+          for (uint32_t owner : others)
+            record(owner);
+          others.push_back(i);
+        }
+
+        for (uint32_t free = mask & ~bits.rows[y]; free; free &= free - 1)
+          bits.owners[y * Chunk::SIZE + std::countr_zero(free)] = i;
+
+        bits.rows[y] |= mask;
+      }
+
+      return false;
+    });
+
+    for (uint32_t owner : hits)
+      overlaps.push_back({ owner, i });
+  }
+
+  return overlaps;
+}
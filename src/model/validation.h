@@ -0,0 +1,28 @@
+#pragma once
+
+#include "piece.h"
+
+#include <vector>
+
+namespace nb
+{
+  class Model;
+
+  class Validator
+  {
+  public:
+    /* pair of overlapping pieces, first is the one that was placed earlier */
+    struct Overlap
+    {
+      size_t first;
+      size_t second;
+    };
+
+    /* true if piece can be placed on the layer without overlapping existing pieces */
+    static bool canPlace(const Model& model, layer_index_t layer, const Piece& piece);
+
+    /* finds every pair of overlapping pieces, returned indices refer to the given records, pairs come grouped by
+       layer and then in the order of their second piece */
+    static std::vector<Overlap> validate(const std::vector<PieceRecord>& pieces);
+  };
+}
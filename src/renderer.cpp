@@ -2,6 +2,7 @@
 
 #include "context.h"
 #include "input.h"
+#include "model/connectivity.h"
 
 nb::layer_iterator_t gfx::TopDownGrid::begin() const
 {
@@ -28,26 +29,66 @@ nb::layer_iterator_t gfx::TopDownGrid::end() const
   return nb::layer_iterator_t(topMostLayer, _shown);
 }
 
+bounds2d_t gfx::TopDownGrid::area() const
+{
+  bounds2d_t area(coord2d_t(0, 0), coord2d_t(Renderer::MIN_LAYER_SIZE, Renderer::MIN_LAYER_SIZE));
+  area.merge(_context->model->bounds().expanded(Renderer::GRID_MARGIN));
+  return area;
+}
+
+rect gfx::TopDownGrid::screenBounds(layer_index_t relative) const
+{
+  const size2d_t size = area().size();
+  const auto& cellSize = Data::Constants::LAYER2D_CELL_SIZE;
+
+  float y = (size.height * cellSize.height + Data::Constants::LAYER2D_SPACING) * relative;
+  return rect(_context->prefs.gridTopPosition().x, _context->prefs.gridTopPosition().y + y, size.width * cellSize.width, size.height * cellSize.height);
+}
+
 auto vertShader = R"(
 #version 330
 
 layout(location=0) in vec3 vertexPosition;
 layout(location=1) in vec3 vertexNormal;
-layout(location=2) in mat4 instanceTransform;
-layout(location=6) in mat4 colorShades;
+layout(location=10) in vec4 instancePosition;
+layout(location=11) in vec4 instanceShape;
 
 uniform mat4 mvp;
+uniform vec2 cellSize;
+uniform vec2 origin;
+uniform float elevation;
+uniform sampler2D palette;
 
 out vec3 vNormalWorld;
 flat out mat4 vColorShades;
 
 void main()
 {
-  mat3 normalMatrix = transpose(inverse(mat3(instanceTransform)));
-  vNormalWorld = normalize(mat3(instanceTransform) * vertexNormal);
-  vColorShades = colorShades;
+  /* empty instances fill the headroom of batch slots, they're moved out of the clip volume */
+  if (instanceShape.x == 0.0)
+  {
+    gl_Position = vec4(0.0, 0.0, 2.0, 1.0);
+    return;
+  }
+  /* position holds the stud of the center in layer space and the layer, shape holds the size in studs, the palette index
+     and whether the center lies half a stud further on each axis,
+     the model origin is applied here so that shifting the model doesn't touch the instances */
+  vec3 scale = vec3(instanceShape.x, 1.0, instanceShape.y);
+  int flags = int(instanceShape.w);
+  vec2 offset = vec2(flags & 1, (flags >> 1) & 1) * 0.5;
+  vec3 center = vec3((instancePosition.x + offset.x + origin.x) * cellSize.x, instancePosition.z * cellSize.y + elevation, (instancePosition.y + offset.y + origin.y) * cellSize.x);
+
+  int color = int(instanceShape.z);
+  vColorShades = mat4(
+    texelFetch(palette, ivec2(0, color), 0),
+    texelFetch(palette, ivec2(1, color), 0),
+    texelFetch(palette, ivec2(2, color), 0),
+    texelFetch(palette, ivec2(3, color), 0)
+  );
+
+  vNormalWorld = normalize(vertexNormal / scale);
 
-  gl_Position = mvp * instanceTransform * vec4(vertexPosition, 1.0);
+  gl_Position = mvp * vec4(vertexPosition * scale + center, 1.0);
 }
 )";
 
@@ -78,83 +119,192 @@ void main()
 }
 )";
 
-// Replica la trasform di DrawModel: T(pos) * R(rot) * S(scale) * model.transform
-static inline Matrix MakeDrawTransform(Vector3 pos, float scale, Matrix rot, const raylib::Matrix& modelMatrix) {
-  Matrix S = MatrixScale(scale, scale, scale);
-  Matrix TS = MatrixMultiply(S, modelMatrix);          // S * model.transform
-  Matrix T = MatrixTranslate(pos.x, pos.y, pos.z);
-  return MatrixMultiply(T, TS);                            // T * (S * model.transform)
+auto edgeVertShader = R"(
+#version 330
+
+layout(location=0) in vec3 vertexPosition;
+layout(location=1) in float vertexSilhouette;
+layout(location=10) in vec4 instancePosition;
+layout(location=11) in vec4 instanceShape;
+
+uniform mat4 mvp;
+uniform vec2 cellSize;
+uniform vec2 origin;
+uniform float elevation;
+uniform vec3 viewPosition;
+uniform sampler2D palette;
+
+flat out vec4 vEdgeColor;
+
+void main()
+{
+  /* empty instances fill the headroom of batch slots, they're moved out of the clip volume */
+  if (instanceShape.x == 0.0)
+  {
+    gl_Position = vec4(0.0, 0.0, 2.0, 1.0);
+    return;
+  }
+  vec3 scale = vec3(instanceShape.x, 1.0, instanceShape.y);
+  int flags = int(instanceShape.w);
+  vec2 offset = vec2(flags & 1, (flags >> 1) & 1) * 0.5;
+  vec3 center = vec3((instancePosition.x + offset.x + origin.x) * cellSize.x, instancePosition.z * cellSize.y + elevation, (instancePosition.y + offset.y + origin.y) * cellSize.x);
+  vec3 position = vertexPosition;
+
+  /* silhouette lines of round shapes are turned to stay perpendicular to the view, their value is the signed radius */
+  if (vertexSilhouette != 0.0)
+  {
+    vec2 view = viewPosition.xz - center.xz;
+    view = dot(view, view) > 1e-5 ? normalize(view) : vec2(1.0, 0.0);
+    position.xz += vec2(-view.y, view.x) * vertexSilhouette;
+  }
+
+  vEdgeColor = texelFetch(palette, ivec2(3, int(instanceShape.z)), 0);
+
+  gl_Position = mvp * vec4(position * scale + center, 1.0);
 }
+)";
+
+auto edgeFragShader = R"(
+#version 330
+
+flat in vec4 vEdgeColor;
 
-// Disegna i 12 bordi del cubo dato centro e dimensioni (in local space) + trasform finale
-static inline void DrawCubeEdgesFast(float w, float h, float d, const Matrix& world, Color col)
+layout(location = 0) out vec4 fragColor;
+
+void main()
 {
-  const float hw = w * 0.5f, hh = h * 0.5f, hd = d * 0.5f;
+  fragColor = vEdgeColor;
+}
+)";
 
-  // 8 vertici in local space
-  Vector3 v[8] = {
-      {- hw, - hh, - hd},
-      {+ hw, - hh, - hd},
-      {+ hw, + hh, - hd},
-      {- hw, + hh, - hd},
-      {- hw, - hh, + hd},
-      {+ hw, - hh, + hd},
-      {+ hw, + hh, + hd},
-      {- hw, + hh, + hd}
-  };
+auto idVertShader = R"(
+#version 330
 
-  // indici dei 12 spigoli
-  const int e[12][2] = {
-      {0,1},{1,2},{2,3},{3,0}, // back (Z-)
-      {4,5},{5,6},{6,7},{7,4}, // front (Z+)
-      {0,4},{1,5},{2,6},{3,7}  // verticali
-  };
+layout(location=0) in vec3 vertexPosition;
+layout(location=2) in vec3 vertexNormal;
+layout(location=10) in vec4 instancePosition;
+layout(location=11) in vec4 instanceShape;
+
+uniform mat4 mvp;
+uniform vec2 cellSize;
+uniform vec2 origin;
+uniform float elevation;
+uniform int idBase;
+
+flat out vec2 vId;
+out vec3 vNormal;
 
-  // trasforma e disegna
-  for (int i = 0; i < 12; ++i) {
-    Vector3 a = Vector3Transform(v[e[i][0]], world);
-    Vector3 b = Vector3Transform(v[e[i][1]], world);
-    DrawLine3D(a, b, col);
-    DrawCylinderEx(a, b, 0.02f, 0.02f, 8, col);
+void main()
+{
+  /* empty instances fill the headroom of batch slots, they're moved out of the clip volume */
+  if (instanceShape.x == 0.0)
+  {
+    gl_Position = vec4(0.0, 0.0, 2.0, 1.0);
+    return;
   }
+  vec3 scale = vec3(instanceShape.x, 1.0, instanceShape.y);
+  int flags = int(instanceShape.w);
+  vec2 offset = vec2(flags & 1, (flags >> 1) & 1) * 0.5;
+  vec3 center = vec3((instancePosition.x + offset.x + origin.x) * cellSize.x, instancePosition.z * cellSize.y + elevation, (instancePosition.y + offset.y + origin.y) * cellSize.x);
+
+  /* ids start from 1 so that 0 is left for the background */
+  vId = vec2(float(idBase + gl_InstanceID + 1), instanceShape.z);
+  vNormal = vertexNormal / scale;
+
+  gl_Position = mvp * vec4(vertexPosition * scale + center, 1.0);
+}
+)";
+
+auto idFragShader = R"(
+#version 330
+
+flat in vec2 vId;
+in vec3 vNormal;
+
+layout(location = 0) out vec4 fragData;
+
+/* octahedral encoding keeps the normal in two channels */
+vec2 encode(vec3 n)
+{
+  n /= abs(n.x) + abs(n.y) + abs(n.z);
+  vec2 e = n.xz;
+  if (n.y < 0.0)
+    e = (1.0 - abs(n.zx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.z >= 0.0 ? 1.0 : -1.0);
+  return e;
+}
+
+void main()
+{
+  fragData = vec4(vId, encode(normalize(vNormal)));
+}
+)";
+
+auto outlineVertShader = R"(
+#version 330
+
+void main()
+{
+  /* a single triangle covering the screen */
+  vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+  gl_Position = vec4(position * 2.0 - 1.0, 0.0, 1.0);
 }
+)";
+
+auto outlineFragShader = R"(
+#version 330
+
+uniform sampler2D ids;
+uniform sampler2D palette;
+
+layout(location = 0) out vec4 fragColor;
+
+const float normalThreshold = 0.8;
 
-// Disegna wireframe cilindro verticale (asse Y)
-void DrawCylinderWireframe(Vector3 center, float radius, float height, int segments, Color col, const Matrix& world, const Camera3D& cam)
+vec3 decode(vec2 e)
 {
-  float y0 = center.y;
-  float y1 = center.y + height;
+  vec3 n = vec3(e.x, 1.0 - abs(e.x) - abs(e.y), e.y);
+  if (n.y < 0.0)
+    n.xz = (1.0 - abs(n.zx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.z >= 0.0 ? 1.0 : -1.0);
+  return normalize(n);
+}
+
+void main()
+{
+  ivec2 size = textureSize(ids, 0);
+  ivec2 p = ivec2(gl_FragCoord.xy);
+  vec4 center = texelFetch(ids, p, 0);
+
+  if (center.x == 0.0)
+    discard;
 
-  // --- cerchio top e bottom ---
-  for (int i = 0; i < segments; i++) {
-    float a0 = (2 * PI * i) / segments;
-    float a1 = (2 * PI * (i + 1)) / segments;
-    Vector3 p0 = { center.x + radius * cosf(a0), y0, center.z + radius * sinf(a0) };
-    Vector3 p1 = { center.x + radius * cosf(a1), y0, center.z + radius * sinf(a1) };
-    Vector3 q0 = { center.x + radius * cosf(a0), y1, center.z + radius * sinf(a0) };
-    Vector3 q1 = { center.x + radius * cosf(a1), y1, center.z + radius * sinf(a1) };
+  vec3 normal = decode(center.zw);
+  bool edge = false;
 
-    DrawCylinderEx(p0, p1, 0.04f, 0.04f, 8, col); // bottom circle
-    DrawCylinderEx(q0, q1, 0.04f, 0.04f, 8, col); // top circle
+  /* each discontinuity is drawn only on one of its sides so that outlines stay one pixel wide */
+  const ivec2 offsets[4] = ivec2[4](ivec2(1, 0), ivec2(-1, 0), ivec2(0, 1), ivec2(0, -1));
+  for (int i = 0; i < 4; ++i)
+  {
+    vec4 other = texelFetch(ids, clamp(p + offsets[i], ivec2(0), size - 1), 0);
+
+    if (other.x < center.x)
+      edge = true;
+    else if (other.x == center.x && dot(decode(other.zw), normal) < normalThreshold && (other.z < center.z || (other.z == center.z && other.w < center.w)))
+      edge = true;
   }
 
-  // --- due generatrici silhouette (a destra/sinistra rispetto alla camera) ---
-  Vector3 viewDir = Vector3Normalize(Vector3Subtract(cam.position, center));
-  // proietta in XZ
-  Vector2 v = { viewDir.x, viewDir.z };
-  float len = sqrtf(v.x * v.x + v.y * v.y);
-  if (len < 1e-5f) { v = { 1,0 }; len = 1; }
-  v.x /= len; v.y /= len;
-  // perpendicolare in XZ
-  Vector2 t = { -v.y, v.x };
+  if (!edge)
+    discard;
 
-  Vector3 a0 = { center.x + radius * t.x, y0, center.z + radius * t.y };
-  Vector3 a1 = { center.x + radius * t.x, y1, center.z + radius * t.y };
-  Vector3 b0 = { center.x - radius * t.x, y0, center.z - radius * t.y };
-  Vector3 b1 = { center.x - radius * t.x, y1, center.z - radius * t.y };
+  fragColor = texelFetch(palette, ivec2(3, int(center.y)), 0);
+}
+)";
 
-  DrawCylinderEx(a0, a1, 0.04f, 0.04f, 8, col);
-  DrawCylinderEx(b0, b1, 0.04f, 0.04f, 8, col);
+// Replica la trasform di DrawModel: T(pos) * R(rot) * S(scale) * model.transform
+static inline Matrix MakeDrawTransform(Vector3 pos, float scale, Matrix rot, const raylib::Matrix& modelMatrix) {
+  Matrix S = MatrixScale(scale, scale, scale);
+  Matrix TS = MatrixMultiply(S, modelMatrix);          // S * model.transform
+  Matrix T = MatrixTranslate(pos.x, pos.y, pos.z);
+  return MatrixMultiply(T, TS);                            // T * (S * model.transform)
 }
 
 #include "par_shapes.h"
@@ -311,27 +461,107 @@ Mesh GenMeshHemiCylinder(float radius, float height, int slices)
   return mesh;
 }
 
+/* line list of the 12 edges of a box centered on the origin */
+static std::vector<gfx::EdgeVertex> GenEdgesBox(float width, float height, float depth)
+{
+  const float hw = width * 0.5f, hh = height * 0.5f, hd = depth * 0.5f;
+  const Vector3 v[8] = {
+    { -hw, -hh, -hd }, { +hw, -hh, -hd }, { +hw, +hh, -hd }, { -hw, +hh, -hd },
+    { -hw, -hh, +hd }, { +hw, -hh, +hd }, { +hw, +hh, +hd }, { -hw, +hh, +hd }
+  };
+
+  const int e[12][2] = {
+    { 0, 1 }, { 1, 2 }, { 2, 3 }, { 3, 0 },
+    { 4, 5 }, { 5, 6 }, { 6, 7 }, { 7, 4 },
+    { 0, 4 }, { 1, 5 }, { 2, 6 }, { 3, 7 }
+  };
+
+  std::vector<gfx::EdgeVertex> vertices;
+  for (const auto& edge : e)
+  {
+    vertices.push_back({ v[edge[0]], 0.0f });
+    vertices.push_back({ v[edge[1]], 0.0f });
+  }
+
+  return vertices;
+}
+
+/* line list of the two circles of a vertical cylinder and of its two silhouette lines, which the shader keeps
+   facing the camera */
+static std::vector<gfx::EdgeVertex> GenEdgesCylinder(float radius, float bottom, float top, int segments)
+{
+  std::vector<gfx::EdgeVertex> vertices;
+
+  for (int i = 0; i < segments; i++)
+  {
+    const float a0 = (2 * PI * i) / segments, a1 = (2 * PI * (i + 1)) / segments;
+
+    for (float y : { bottom, top })
+    {
+      vertices.push_back({ { radius * cosf(a0), y, radius * sinf(a0) }, 0.0f });
+      vertices.push_back({ { radius * cosf(a1), y, radius * sinf(a1) }, 0.0f });
+    }
+  }
+
+  for (float r : { radius, -radius })
+  {
+    vertices.push_back({ { 0.0f, bottom, 0.0f }, r });
+    vertices.push_back({ { 0.0f, top, 0.0f }, r });
+  }
+
+  return vertices;
+}
+
 //TODO: these are duplicated from main.cpp, move to a common header
 constexpr float side = 3.8f;   // lato
 constexpr float height = 3.1f;
 constexpr float studHeight = 1.4f;
 constexpr float studDiameter = 2.5f;
 
+static void LoadFlatShader(FlatShader& shader, const char* vertex, const char* fragment)
+{
+  shader.shader = raylib::Shader::LoadFromMemory(vertex, fragment);
+  shader.shader.locs[SHADER_LOC_MATRIX_MVP] = shader->GetLocation("mvp");
+  shader.shader.locs[SHADER_LOC_MAP_DIFFUSE] = shader->GetLocation("palette");
+  shader.locationInstancePosition = shader->GetLocationAttrib("instancePosition");
+  shader.locationInstanceShape = shader->GetLocationAttrib("instanceShape");
+  shader.locationCellSize = shader->GetLocation("cellSize");
+  shader.locationElevation = shader->GetLocation("elevation");
+  shader.locationViewPosition = shader->GetLocation("viewPosition");
+  shader.locationIdBase = shader->GetLocation("idBase");
+  shader.locationOrigin = shader->GetLocation("origin");
+
+  const Vector2 cellSize = { side, height };
+  shader->SetValue(shader.locationCellSize, &cellSize, SHADER_UNIFORM_VEC2);
+}
+
 gfx::Renderer::Renderer(Context* context) : _context(context), _topDown(context) { }
 
 void gfx::Renderer::init()
 {
-  shaders.flatShading.shader = raylib::Shader::LoadFromMemory(vertShader, fragShader);
-  shaders.flatShading.shader.locs[SHADER_LOC_MATRIX_MVP] = shaders.flatShading->GetLocation("mvp");
-  shaders.flatShading.locationInstanceTransform = shaders.flatShading->GetLocationAttrib("instanceTransform");
-  shaders.flatShading.locationColorShade = shaders.flatShading->GetLocationAttrib("colorShades");
+  LoadFlatShader(shaders.flatShading, vertShader, fragShader);
+  LoadFlatShader(shaders.edgeShading, edgeVertShader, edgeFragShader);
+  LoadFlatShader(shaders.idShading, idVertShader, idFragShader);
+
+  _outlineShader = raylib::Shader::LoadFromMemory(outlineVertShader, outlineFragShader);
+  _outlineLocationIds = _outlineShader.GetLocation("ids");
+  _outlineLocationPalette = _outlineShader.GetLocation("palette");
+  /* the full screen triangle has no attributes but core profiles still need a vertex array bound */
+  _outlineVaoID = rlLoadVertexArray();
 
   materials.flatMaterial.shader = shaders.flatShading.shader;
+  materials.edgeMaterial.shader = shaders.edgeShading.shader;
+  materials.idMaterial.shader = shaders.idShading.shader;
   
-  _cubeBatch.setup(raylib::MeshUnmanaged::Cube(side, height, side), &shaders.flatShading);
+  /* cubes and cylinders are centered on their layer, studs stand on top of it */
+  _cubeBatch.setup(raylib::MeshUnmanaged::Cube(side, height, side), &shaders.flatShading, height * 0.5f);
   //_cylinderBatch.setup(raylib::MeshUnmanaged::Cylinder(side / 2, height, 32), &shaders.flatShading);
-  _cylinderBatch.setup(GenMeshHemiCylinder(side / 2, height, 32), &shaders.flatShading);
-  _studBatch.setup(raylib::MeshUnmanaged::Cylinder(studDiameter / 2.0f, studHeight, 32), &shaders.flatShading);
+  _cylinderBatch.setup(GenMeshHemiCylinder(side / 2, height, 32), &shaders.flatShading, height * 0.5f);
+  _studBatch.setup(raylib::MeshUnmanaged::Cylinder(studDiameter / 2.0f, studHeight, 32), &shaders.flatShading, height);
+
+  _cubeBatch.setupEdges(GenEdgesBox(side, height, side), &shaders.edgeShading);
+  _cylinderBatch.setupEdges(GenEdgesCylinder(side / 2, -height * 0.5f, height * 0.5f, 32), &shaders.edgeShading);
+  _studBatch.setupEdges(GenEdgesCylinder(studDiameter / 2.0f, 0.0f, studHeight, 32), &shaders.edgeShading);
 
   /* we need to shift all vertices of cylinder because it's zero aligned */
   for (int i = 0; i < _cylinderBatch.mesh().vertexCount; ++i)
@@ -347,11 +577,63 @@ void gfx::Renderer::init()
 
 void gfx::Renderer::deinit()
 {
+  if (_paletteTexture)
+    rlUnloadTexture(_paletteTexture);
+  _paletteTexture = 0;
+  _paletteSize = 0;
+
+  /* materials don't own the palette texture, maps are gone if deinit already ran */
+  if (materials.flatMaterial.maps)
+    materials.flatMaterial.maps[MATERIAL_MAP_DIFFUSE].texture.id = 0;
+  if (materials.edgeMaterial.maps)
+    materials.edgeMaterial.maps[MATERIAL_MAP_DIFFUSE].texture.id = 0;
   materials.flatMaterial.Unload();
+  materials.edgeMaterial.Unload();
+  materials.idMaterial.Unload();
+
+  _idTarget.Unload();
+  _idTarget.id = 0;
+  if (_outlineShader.id)
+    UnloadShader(_outlineShader);
+  _outlineShader.id = 0;
+  if (_outlineVaoID)
+    rlUnloadVertexArray(_outlineVaoID);
+  _outlineVaoID = 0;
 }
 
-void gfx::Renderer::renderLayerGrid2d(vec2 base, const nb::Layer* layer, size2d_t layerSize, size2d_t cellSize)
+void gfx::Renderer::updatePalette()
 {
+  const nb::Palette& palette = nb::Palette::global();
+  if (_paletteTexture && _paletteSize == palette.size())
+    return;
+
+  /* one row per palette index with the 4 shades of the color, indices without a color stay transparent */
+  constexpr int SHADES = 4, ROWS = 256;
+  std::vector<Color> pixels(SHADES * ROWS, Color{ 0, 0, 0, 0 });
+
+  for (size_t i = 0; i < palette.size(); ++i)
+  {
+    const nb::PieceColor* color = palette[static_cast<nb::palette_index_t>(i)];
+    for (int j = 0; j < SHADES; ++j)
+      pixels[i * SHADES + j] = color->colors[j];
+  }
+
+  if (_paletteTexture)
+    rlUpdateTexture(_paletteTexture, 0, 0, SHADES, ROWS, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8, pixels.data());
+  else
+    _paletteTexture = rlLoadTexture(pixels.data(), SHADES, ROWS, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8, 1);
+
+  _paletteSize = palette.size();
+  materials.flatMaterial.maps[MATERIAL_MAP_DIFFUSE].texture.id = _paletteTexture;
+  materials.edgeMaterial.maps[MATERIAL_MAP_DIFFUSE].texture.id = _paletteTexture;
+}
+
+void gfx::Renderer::renderLayerGrid2d(vec2 base, layer_index_t index, const bounds2d_t& area, size2d_t cellSize)
+{
+  const nb::Layer* layer = _context->model->layer(index);
+
+  const size2d_t layerSize = area.size();
+
   /* draw a thin black grid with half opacity over the pieces */
   for (int x = 0; x <= layerSize.width; ++x)
   {
@@ -367,36 +649,45 @@ void gfx::Renderer::renderLayerGrid2d(vec2 base, const nb::Layer* layer, size2d_
     DrawLineV(p0, p1, color(0, 0, 0, 100));
   }
 
+  /* pieces are stored relative to model origin, grid starts at the top left corner of the area */
+  const coord2d_t origin = _context->model->origin();
+  const vec2 piecesBase = base + vec2((origin.x - area.min.x) * cellSize.width, (origin.y - area.min.y) * cellSize.height);
+
   /* draw pieces of layer below with half opacity */
-  auto prev = layer->prev();
+  const nb::Layer* prev = _context->model->layer(index - 1);
   if (prev)
   {
     for (const nb::Piece& piece : prev->pieces())
     {
-      vec2 pos = vec2(base.x + piece.x() * cellSize.width, base.y + piece.y() * cellSize.height);
+      vec2 pos = vec2(piecesBase.x + piece.x() * cellSize.width, piecesBase.y + piece.y() * cellSize.height);
       vec2 size = vec2(piece.width() * cellSize.width, piece.height() * cellSize.height);
       DrawRectangleV(pos, size, piece.color()->top().Fade(0.5f));
       DrawRectangleLinesEx(rect(pos.x, pos.y, size.x, size.y), 1.0f, piece.color()->edge().Fade(0.8f));
     }
   }
   
-  /* draw pieces as rect with outline using piece color */
-  for (const nb::Piece& piece : layer->pieces())
+  /* draw pieces as rect with outline using piece color, pieces not held by anything are outlined in red */
+  for (size_t i = 0; i < layer->pieces().size(); ++i)
   {
-    vec2 pos = vec2(base.x + piece.x() * cellSize.width, base.y + piece.y() * cellSize.height);
+    const nb::Piece piece = layer->pieces()[i];
+    vec2 pos = vec2(piecesBase.x + piece.x() * cellSize.width, piecesBase.y + piece.y() * cellSize.height);
     vec2 size = vec2(piece.width() * cellSize.width, piece.height() * cellSize.height);
 
     DrawRectangleV(pos, size, piece.color()->top());
-    DrawRectangleLinesEx(rect(pos.x, pos.y, size.x, size.y), 2.0f, piece.color()->edge());
+
+    if (_context->connectivity->floating(layer, i))
+      DrawRectangleLinesEx(rect(pos.x, pos.y, size.x, size.y), 2.0f, color(230, 0, 0, 255));
+    else
+      DrawRectangleLinesEx(rect(pos.x, pos.y, size.x, size.y), 2.0f, piece.color()->edge());
   }
 
   /* draw hover if present */
   if (_context->input->hover())
   {
     const coord3d_t& hover = *_context->input->hover();
-    if (hover.z == layer->index() || _context->prefs.ui.drawHoverOnAllLayers)
+    if (hover.z == index || _context->prefs.ui.drawHoverOnAllLayers)
     {
-      vec2 pos = vec2(base.x + hover.x * cellSize.width, base.y + hover.y * cellSize.height);
+      vec2 pos = vec2(base.x + (hover.x - area.min.x) * cellSize.width, base.y + (hover.y - area.min.y) * cellSize.height);
       vec2 size = vec2(cellSize.width * _context->brush->width(), cellSize.height * _context->brush->height());
       DrawRectangleV(pos, size, color(180, 0, 0, 100));
       DrawRectangleLinesEx(rect(pos.x, pos.y, size.x, size.y), 2.0f, color(255, 0, 0, 200));
@@ -406,132 +697,479 @@ void gfx::Renderer::renderLayerGrid2d(vec2 base, const nb::Layer* layer, size2d_
 
 void gfx::Renderer::render(const nb::Model* model)
 {
-  _studBatch.instanceData().clear();
+  _stats = FrameStats();
+  updatePalette();
+
+  /* shifting the model only moves this uniform, instances are kept in layer space */
+  const Vector2 origin = { static_cast<float>(model->origin().x), static_cast<float>(model->origin().y) };
+  for (FlatShader* shader : { &shaders.flatShading, &shaders.edgeShading, &shaders.idShading })
+    shader->shader.SetValue(shader->locationOrigin, &origin, SHADER_UNIFORM_VEC2);
 
   renderModel(model);
-  renderStuds();
 }
 
-void gfx::Renderer::renderLayerGrid3d(layer_index_t index, size2d_t size)
+void gfx::Renderer::renderLayerGrid3d(layer_index_t index, const bounds2d_t& area)
 {
-  for (int x = 0; x <= size.width; ++x)
+  for (int x = area.min.x; x <= area.max.x; ++x)
   {
     /* draw vertical lines using DrawCylinderEx */
-    Vector3 p0 = { x * side, index * height, 0.0f };
-    Vector3 p1 = { x * side, index * height, (size.height) * side };
+    Vector3 p0 = { x * side, index * height, area.min.y * side };
+    Vector3 p1 = { x * side, index * height, area.max.y * side };
     DrawCylinderEx(p0, p1, 0.02f, 0.02f, EDGE_COMPLEXITY, raylib::Color(80, 80, 80, 100));
   }
 
-  for (int y = 0; y <= size.height; ++y)
+  for (int y = area.min.y; y <= area.max.y; ++y)
   {
     /* draw horizontal lines using DrawCylinderEx */
-    Vector3 p0 = { 0.0f, index * height, y * side };
-    Vector3 p1 = { (size.width) * side, index * height, y * side };
+    Vector3 p0 = { area.min.x * side, index * height, y * side };
+    Vector3 p1 = { area.max.x * side, index * height, y * side };
     DrawCylinderEx(p0, p1, 0.02f, 0.02f, EDGE_COMPLEXITY, raylib::Color(80, 80, 80, 100));
   }
 }
 
-void gfx::Renderer::prepareStudsForPiece(const nb::Piece* piece, const raylib::Matrix& layerTransform)
+/* true if every cell of area is covered by square pieces of the layer, round pieces leave gaps around them */
+static bool IsCoveredBySquares(const nb::Layer* layer, const bounds2d_t& area)
+{
+  if (!layer || !layer->occupancy().covers(area))
+    return false;
+
+  const nb::OccupancyIndex& occupancy = layer->occupancy();
+  for (coord_t y = area.min.y; y < area.max.y; ++y)
+    for (coord_t x = area.min.x; x < area.max.x; ++x)
+      if (layer->pieces()[occupancy.at(coord2d_t(x, y))].type() != nb::PieceType::Square)
+        return false;
+
+  return true;
+}
+
+/* a piece is enclosed when the layers above and below cover it and its own layer surrounds all its sides */
+static bool IsEnclosed(const nb::Piece& piece, const nb::Layer* layer, const nb::Layer* below, const nb::Layer* above)
 {
+  const bounds2d_t bounds = piece.bounds();
+
+  return IsCoveredBySquares(above, bounds) && IsCoveredBySquares(below, bounds) &&
+    IsCoveredBySquares(layer, bounds2d_t(coord2d_t(bounds.min.x - 1, bounds.min.y), coord2d_t(bounds.min.x, bounds.max.y))) &&
+    IsCoveredBySquares(layer, bounds2d_t(coord2d_t(bounds.max.x, bounds.min.y), coord2d_t(bounds.max.x + 1, bounds.max.y))) &&
+    IsCoveredBySquares(layer, bounds2d_t(coord2d_t(bounds.min.x, bounds.min.y - 1), coord2d_t(bounds.max.x, bounds.min.y))) &&
+    IsCoveredBySquares(layer, bounds2d_t(coord2d_t(bounds.min.x, bounds.max.y), coord2d_t(bounds.max.x, bounds.max.y + 1)));
+}
+
+size_t gfx::Renderer::prepareStudsForPiece(const nb::Piece* piece, const nb::Layer* above, layer_index_t index, std::vector<InstanceData>& studs)
+{
+  const nb::palette_index_t color = piece->colorIndex();
+  size_t culled = 0;
+
   if (piece->studs() == nb::StudMode::None)
-    return;
+    return 0;
   else if (piece->studs() == nb::StudMode::Centered)
   {
-    _studBatch.instanceData().push_back({ layerTransform * raylib::Matrix::Translate((piece->x() + piece->width() * 0.5f) * side, height, (piece->y() + piece->height() * 0.5f) * side), piece->color()});
-
-    raylib::Vector3 center = raylib::Vector3::Zero();
-    center = center.Transform(_studBatch.instanceData().back().matrix);
+    /* the stud sits over the one or two middle cells on each axis */
+    const coord2d_t from = coord2d_t(piece->x() + (piece->width() - 1) / 2, piece->y() + (piece->height() - 1) / 2);
+    const coord2d_t to = coord2d_t(piece->x() + piece->width() / 2 + 1, piece->y() + piece->height() / 2 + 1);
 
-    DrawCylinderWireframe(center, studDiameter / 2.0f, studHeight, 32, piece->color()->edge(), MatrixIdentity(), _camera);
+    if (IsCoveredBySquares(above, bounds2d_t(from, to)))
+      ++culled;
+    else
+    {
+      InstanceData stud = InstanceData::centeredOn(piece->coord(), piece->size(), index, color);
+      stud.width = stud.height = 1;
+      studs.push_back(stud);
+    }
   }
   else
   {
-    for (int y = 0; y < piece->height(); ++y)
-      for (int x = 0; x < piece->width(); ++x)
+    for (int16_t sy = 0; sy < piece->height(); ++sy)
+    {
+      for (int16_t sx = 0; sx < piece->width(); ++sx)
       {
-        _studBatch.instanceData().push_back({ layerTransform * raylib::Matrix::Translate((piece->x() + x + 0.5f) * side, height, (piece->y() + y + 0.5f) * side), piece->color() });
-
-        raylib::Vector3 center = raylib::Vector3::Zero();
-        center = center.Transform(_studBatch.instanceData().back().matrix);
+        const coord2d_t cell = coord2d_t(piece->x() + sx, piece->y() + sy);
 
-        DrawCylinderWireframe(center, studDiameter / 2.0f, studHeight, 32, piece->color()->edge(), MatrixIdentity(), _camera);
+        if (IsCoveredBySquares(above, bounds2d_t(cell, cell + coord2d_t(1, 1))))
+          ++culled;
+        else
+          studs.push_back(InstanceData::centeredOn(cell, size2d_t(1, 1), index, color));
       }
+    }
   }
+
+  return culled;
 }
 
-void gfx::Renderer::renderLayer(const nb::Layer* layer)
+void gfx::Renderer::freeChunk(ChunkCache& chunk)
 {
-  /* compute the matrix for the layer */
-  raylib::Matrix layerTransform = raylib::Matrix::Translate(0.0f, layer->index() * height, 0.0f);
+  _cubeBatch.free(chunk.cubesSlot);
+  _cylinderBatch.free(chunk.cylindersSlot);
+  _studBatch.free(chunk.studsSlot);
+}
 
-  for (const nb::Piece& piece : layer->pieces())
-  {
-    /* translate inside layer according to position */
-    raylib::Matrix pieceTransform = raylib::Matrix::Translate((piece.x() + piece.width() * 0.5f) * side, height * 0.5f, (piece.y() + piece.height() * 0.5f) * side);
+void gfx::Renderer::prepareChunk(const nb::Layer* layer, const nb::Layer* below, const nb::Layer* above, layer_index_t index, coord_t cx, coord_t cy, LayerCache& cache)
+{
+  const uint64_t key = nb::OccupancyIndex::key(cx, cy);
+  ChunkCache& chunk = cache.chunks[key];
+  const auto& pieces = layer->pieces();
+
+  chunk.position = coord2d_t(cx, cy);
+
+  cache.culledPieces -= chunk.culledPieces;
+  cache.culledStuds -= chunk.culledStuds;
 
-    prepareStudsForPiece(&piece, layerTransform);
-    
-    pieceTransform = raylib::Matrix::Scale(piece.width(), 1.0f, piece.height()) * pieceTransform;
-    auto finalTransform = layerTransform * pieceTransform;
-    
-    if (piece.type() == nb::PieceType::Round)
+  chunk.cubes.clear();
+  chunk.cylinders.clear();
+  chunk.studs.clear();
+  chunk.culledPieces = 0;
+  chunk.culledStuds = 0;
+
+  /* instances stay in layer space, the shaders apply the model origin */
+  if (const nb::Chunk* source = layer->occupancy().chunk(cx, cy))
+  {
+    for (nb::piece_index_t i : source->pieces)
     {
-      _cylinderBatch.instanceData().push_back({ finalTransform, piece.color() });
+      const nb::Piece piece = pieces[i];
+
+      /* a piece spanning many chunks belongs to the one holding its first cell */
+      if (nb::OccupancyIndex::chunkOf(piece.x()) != cx || nb::OccupancyIndex::chunkOf(piece.y()) != cy)
+        continue;
 
-      raylib::Vector3 center = vec3(0.0f, -height / 2.0f, 0.0f);
-      center = center.Transform(finalTransform);
+      /* enclosed pieces have their studs covered as well */
+      if (IsEnclosed(piece, layer, below, above))
+      {
+        ++chunk.culledPieces;
+        chunk.culledStuds += piece.studs() == nb::StudMode::Full ? piece.width() * piece.height() : (piece.studs() == nb::StudMode::Centered ? 1 : 0);
+        continue;
+      }
+
+      chunk.culledStuds += prepareStudsForPiece(&piece, above, index, chunk.studs);
 
-      DrawCylinderWireframe(center, side / 2, height, 32, piece.color()->edge(), MatrixIdentity(), _camera);
+      const InstanceData instance = InstanceData::centeredOn(piece.coord(), piece.size(), index, piece.colorIndex());
+
+      if (piece.type() == nb::PieceType::Round)
+        chunk.cylinders.push_back(instance);
+      else
+        chunk.cubes.push_back(instance);
     }
-    else
+  }
+
+  cache.culledPieces += chunk.culledPieces;
+  cache.culledStuds += chunk.culledStuds;
+
+  if (chunk.cubes.empty() && chunk.cylinders.empty() && chunk.studs.empty() && !chunk.culledPieces && !chunk.culledStuds)
+  {
+    freeChunk(chunk);
+    cache.chunks.erase(key);
+    return;
+  }
+
+  _studBatch.assign(chunk.studsSlot, chunk.studs, true);
+  _cylinderBatch.assign(chunk.cylindersSlot, chunk.cylinders, true);
+  _cubeBatch.assign(chunk.cubesSlot, chunk.cubes, true);
+}
+
+bool gfx::Renderer::readJournal(const nb::Model* model)
+{
+  const nb::Journal& journal = model->journal();
+  _editedAreas.clear();
+
+  /* a model loaded in place of the previous one comes with a journal of its own */
+  if (journal.id() != _journalId)
+  {
+    _journalId = journal.id();
+    _journalCursor = journal.version();
+    return false;
+  }
+
+  return journal.read(_journalCursor, [this](const nb::Change& change) {
+    auto& areas = _editedAreas[change.layer];
+    areas.push_back(change.piece.bounds());
+    if (change.type == nb::ChangeType::Moved)
+      areas.push_back(change.piece.bounds().translated(coord2d_t(-change.delta.x, -change.delta.y)));
+  });
+}
+
+void gfx::Renderer::renderLayer(const nb::Layer* layer, layer_index_t index, LayerCache& cache, bool journaled)
+{
+  const nb::Layer* below = _context->model->layer(index - 1);
+  const nb::Layer* above = _context->model->layer(index + 1);
+  const layer_id_t belowId = below ? below->id() : nb::LayerOrder::NIL, aboveId = above ? above->id() : nb::LayerOrder::NIL;
+  const uint64_t belowVersion = below ? below->version() : 0, aboveVersion = above ? above->version() : 0;
+
+  auto edited = [this, journaled](const nb::Layer* other) -> const std::vector<bounds2d_t>* {
+    auto it = other && journaled ? _editedAreas.find(other->id()) : _editedAreas.end();
+    return it != _editedAreas.end() ? &it->second : nullptr;
+  };
+  const std::vector<bounds2d_t>* editedSelf = edited(layer);
+  const std::vector<bounds2d_t>* editedBelow = edited(below);
+  const std::vector<bounds2d_t>* editedAbove = edited(above);
+
+  /* the layer is rebuilt whole when its neighbours are other layers or when it or its neighbours changed in ways
+     the journal doesn't describe, otherwise only the chunks of the pieces around the edits are */
+  const size_t edits = (editedSelf ? editedSelf->size() : 0) + (editedBelow ? editedBelow->size() : 0) + (editedAbove ? editedAbove->size() : 0);
+  const bool rebuild = !cache.built || cache.below != belowId || cache.above != aboveId ||
+    (cache.version != layer->version() && !editedSelf) || (cache.belowVersion != belowVersion && !editedBelow) ||
+    (cache.aboveVersion != aboveVersion && !editedAbove) || (edits * REBUILD_RATIO > layer->pieces().size() && edits > 64);
+
+  std::unordered_map<uint64_t, coord2d_t> dirty;
+  auto mark = [&dirty](coord_t cx, coord_t cy) { dirty.emplace(nb::OccupancyIndex::key(cx, cy), coord2d_t(cx, cy)); };
+  auto markPieces = [layer, &mark](const bounds2d_t& area) {
+    layer->query(area, [layer, &mark](size_t i) {
+      const nb::Piece piece = layer->pieces()[i];
+      mark(nb::OccupancyIndex::chunkOf(piece.x()), nb::OccupancyIndex::chunkOf(piece.y()));
+    });
+  };
+
+  if (rebuild)
+  {
+    for (const auto& [key, chunk] : cache.chunks)
+      mark(chunk.position.x, chunk.position.y);
+    for (const auto& [key, chunk] : layer->occupancy().chunks())
+      mark(chunk.origin.x >> nb::Chunk::SHIFT, chunk.origin.y >> nb::Chunk::SHIFT);
+  }
+  else
+  {
+    /* an edit decides what is hidden of the pieces next to it in its own layer and of the pieces right over and under it,
+       the chunk which held the edited piece is rebuilt even if the piece is gone */
+    if (editedSelf)
     {
-      _cubeBatch.instanceData().push_back({ finalTransform, piece.color() });
-      DrawCubeEdgesFast(side, height, side, finalTransform, piece.color()->edge());
+      for (const bounds2d_t& area : *editedSelf)
+      {
+        mark(nb::OccupancyIndex::chunkOf(area.min.x), nb::OccupancyIndex::chunkOf(area.min.y));
+        markPieces(area.expanded(1));
+      }
     }
 
+    for (const auto* areas : { editedBelow, editedAbove })
+      if (areas)
+        for (const bounds2d_t& area : *areas)
+          markPieces(area);
+
+    /* a layer which only moved to another position keeps what it hides, its instances are just relabeled */
+    if (cache.index != index)
+    {
+      for (auto& [key, chunk] : cache.chunks)
+      {
+        if (dirty.count(key))
+          continue;
+
+        for (auto* instances : { &chunk.studs, &chunk.cylinders, &chunk.cubes })
+          for (InstanceData& instance : *instances)
+            instance.layer = static_cast<int16_t>(index);
+
+        _studBatch.assign(chunk.studsSlot, chunk.studs, true);
+        _cylinderBatch.assign(chunk.cylindersSlot, chunk.cylinders, true);
+        _cubeBatch.assign(chunk.cubesSlot, chunk.cubes, true);
+      }
+    }
   }
 
-  for (auto* batch : _shapeBatches)
-    batch->draw(materials.flatMaterial);
+  for (const auto& [key, chunk] : dirty)
+    prepareChunk(layer, below, above, index, chunk.x, chunk.y, cache);
+
+  cache.built = true;
+  cache.version = layer->version();
+  cache.index = index;
+  cache.below = belowId;
+  cache.belowVersion = belowVersion;
+  cache.above = aboveId;
+  cache.aboveVersion = aboveVersion;
+
+  _stats.pieces += layer->pieces().size();
+  _stats.culledPieces += cache.culledPieces;
+  _stats.culledStuds += cache.culledStuds;
 }
 
-void gfx::Renderer::renderStuds()
+void gfx::Renderer::drawBatches()
 {
-  _studBatch.draw(materials.flatMaterial);
-  _studBatch.instanceData().clear();
+  for (auto* batch : _shapeBatches)
+  {
+    size_t count = batch->draw(materials.flatMaterial, shaders.flatShading);
+    _stats.instances += count;
+    _stats.drawCalls += count ? 1 : 0;
+    _stats.uploadedBytes += batch->uploaded();
+  }
+
+  _stats.studs = _studBatch.draw(materials.flatMaterial, shaders.flatShading);
+  _stats.drawCalls += _stats.studs ? 1 : 0;
+  _stats.uploadedBytes += _studBatch.uploaded();
+
+  /* edges reuse the instances uploaded for the faces */
+  if (_edgeMode == EdgeMode::Geometry)
+  {
+    for (auto* batch : { &_cubeBatch, &_cylinderBatch, &_studBatch })
+      _stats.drawCalls += batch->drawEdges(materials.edgeMaterial, shaders.edgeShading, _camera.position) ? 1 : 0;
+  }
+  else
+    renderOutlines();
 }
 
 void gfx::Renderer::renderModel(const nb::Model* model)
 {
-  _cylinderBatch.instanceData().clear();
-  _cubeBatch.instanceData().clear();
-  
-  for (const auto& layer : model->layers())
-    renderLayer(layer.get());
+  ++_frame;
+  const bool journaled = readJournal(model);
+
+  model->eachLayer([this, journaled](layer_index_t index, const nb::Layer* layer) {
+    LayerCache& cache = _layerCaches[layer->id()];
+    cache.frame = _frame;
+    renderLayer(layer, index, cache, journaled);
+  });
+
+  /* layers which are gone give their slots back */
+  for (auto it = _layerCaches.begin(); it != _layerCaches.end(); )
+  {
+    if (it->second.frame != _frame)
+    {
+      for (auto& [key, chunk] : it->second.chunks)
+        freeChunk(chunk);
+      it = _layerCaches.erase(it);
+    }
+    else
+      ++it;
+  }
 
-  renderLayerGrid3d(0, size2d_t(MOCK_LAYER_SIZE, MOCK_LAYER_SIZE));
+  /* instances of all layers are in their slots now, each batch is uploaded and drawn once */
+  drawBatches();
+
+  renderLayerGrid3d(0, _topDown.area());
 }
 
 #include "glad/glad.h"
 
+void gfx::Renderer::updateIdTarget()
+{
+  const int screenWidth = GetRenderWidth(), screenHeight = GetRenderHeight();
+  if (_idTarget.id && _idTarget.texture.width == screenWidth && _idTarget.texture.height == screenHeight)
+    return;
+
+  _idTarget.Unload();
+
+  /* ids go up to 2^24 and normals need more than 8 bits so the target is made of floats */
+  ::RenderTexture target = {};
+  target.id = rlLoadFramebuffer();
+  target.texture.id = rlLoadTexture(nullptr, screenWidth, screenHeight, RL_PIXELFORMAT_UNCOMPRESSED_R32G32B32A32, 1);
+  target.texture.width = screenWidth;
+  target.texture.height = screenHeight;
+  target.texture.format = PIXELFORMAT_UNCOMPRESSED_R32G32B32A32;
+  target.texture.mipmaps = 1;
+  target.depth.id = rlLoadTextureDepth(screenWidth, screenHeight, true);
+  target.depth.width = screenWidth;
+  target.depth.height = screenHeight;
+
+  rlFramebufferAttach(target.id, target.texture.id, RL_ATTACHMENT_COLOR_CHANNEL0, RL_ATTACHMENT_TEXTURE2D, 0);
+  rlFramebufferAttach(target.id, target.depth.id, RL_ATTACHMENT_DEPTH, RL_ATTACHMENT_RENDERBUFFER, 0);
+  rlDisableFramebuffer();
+
+  _idTarget = target;
+}
+
+void gfx::Renderer::renderOutlines()
+{
+  updateIdTarget();
+
+  /* whatever is pending in the immediate mode batch belongs to the screen */
+  rlDrawRenderBatchActive();
+
+  /* matrices of the 3d mode stay active, only the target and the viewport change */
+  rlEnableFramebuffer(_idTarget.id);
+  rlViewport(0, 0, _idTarget.texture.width, _idTarget.texture.height);
+  rlClearColor(0, 0, 0, 0);
+  rlClearScreenBuffers();
+
+  int idBase = 0;
+  for (auto* batch : { &_cubeBatch, &_cylinderBatch, &_studBatch })
+  {
+    rlEnableShader(shaders.idShading->id);
+    rlSetUniform(shaders.idShading.locationIdBase, &idBase, RL_SHADER_UNIFORM_INT, 1);
+    rlDisableShader();
+
+    const size_t count = batch->draw(materials.idMaterial, shaders.idShading);
+    _stats.drawCalls += count ? 1 : 0;
+    idBase += static_cast<int>(batch->extent());
+  }
+
+  rlDisableFramebuffer();
+  rlViewport(0, 0, GetRenderWidth(), GetRenderHeight());
+
+  /* outlines are drawn over everything, the ids already tell which piece is in front */
+  rlDisableDepthTest();
+  rlEnableShader(_outlineShader.id);
+
+  const int idsSlot = 0, paletteSlot = 1;
+  rlActiveTextureSlot(idsSlot);
+  rlEnableTexture(_idTarget.texture.id);
+  rlSetUniform(_outlineLocationIds, &idsSlot, RL_SHADER_UNIFORM_INT, 1);
+  rlActiveTextureSlot(paletteSlot);
+  rlEnableTexture(_paletteTexture);
+  rlSetUniform(_outlineLocationPalette, &paletteSlot, RL_SHADER_UNIFORM_INT, 1);
+
+  rlEnableVertexArray(_outlineVaoID);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+  rlDisableVertexArray();
+  _stats.drawCalls += 1;
+
+  rlDisableTexture();
+  rlActiveTextureSlot(idsSlot);
+  rlDisableTexture();
+
+  rlDisableShader();
+  rlEnableDepthTest();
+}
+
 gfx::Batch::~Batch()
 {
   //_mesh.Unload();
 }
 
-void gfx::Batch::draw(const Material& material)
+static constexpr int MAX_MATERIAL_MAPS = 4;
+
+static void BindMaterialMaps(const Material& material)
 {
-  if (_instanceData.empty())
-    return;
-  
-  constexpr size_t MAX_MATERIAL_MAPS = 4;
+  // Bind active texture maps (if available)
+  for (int i = 0; i < MAX_MATERIAL_MAPS; i++)
+  {
+    if (material.maps[i].texture.id > 0)
+    {
+      // Select current shader texture slot
+      rlActiveTextureSlot(i);
+
+      // Enable texture for active slot
+      rlEnableTexture(material.maps[i].texture.id);
+
+      rlSetUniform(material.shader.locs[SHADER_LOC_MAP_DIFFUSE + i], &i, RL_SHADER_UNIFORM_INT, 1);
+    }
+  }
+}
+
+static void UnbindMaterialMaps(const Material& material)
+{
+  // Unbind all bound texture maps
+  for (int i = 0; i < MAX_MATERIAL_MAPS; i++)
+  {
+    if (material.maps[i].texture.id > 0)
+    {
+      // Select current shader texture slot
+      rlActiveTextureSlot(i);
+
+      // Disable texture for active slot
+      if ((i == MATERIAL_MAP_IRRADIANCE) ||
+        (i == MATERIAL_MAP_PREFILTER) ||
+        (i == MATERIAL_MAP_CUBEMAP)) rlDisableTextureCubemap();
+      else rlDisableTexture();
+    }
+  }
+}
 
-  // Instancing required variables
-  float16* instanceTransforms = NULL;
+size_t gfx::Batch::draw(const Material& material, const FlatShader& shader)
+{
+  _uploaded = 0;
 
+  if (!_count)
+    return 0;
+  
   // Bind shader program
   rlEnableShader(material.shader.id);
 
+  rlSetUniform(shader.locationElevation, &_elevation, RL_SHADER_UNIFORM_FLOAT, 1);
+
+  BindMaterialMaps(material);
+
   Matrix matModel = MatrixIdentity();
   Matrix matView = rlGetMatrixModelview();
   Matrix matModelView = MatrixIdentity();
@@ -547,7 +1185,7 @@ void gfx::Batch::draw(const Material& material)
     rlSetUniformMatrix(material.shader.locs[SHADER_LOC_MATRIX_NORMAL], MatrixTranspose(MatrixInvert(matModel)));
 
 
-  update(_mesh);
+  update();
   
   // Try binding vertex array objects (VAO)
   // or use VBOs if not possible
@@ -561,25 +1199,11 @@ void gfx::Batch::draw(const Material& material)
 
   // Draw mesh instanced
   if (_mesh.indices != NULL)
-    rlDrawVertexArrayElementsInstanced(0, _mesh.triangleCount * 3, 0, _instanceData.size());
+    rlDrawVertexArrayElementsInstanced(0, _mesh.triangleCount * 3, 0, _count);
   else
-    rlDrawVertexArrayInstanced(0, _mesh.vertexCount, _instanceData.size());
+    rlDrawVertexArrayInstanced(0, _mesh.vertexCount, _count);
 
-  // Unbind all bound texture maps
-  for (int i = 0; i < MAX_MATERIAL_MAPS; i++)
-  {
-    if (material.maps[i].texture.id > 0)
-    {
-      // Select current shader texture slot
-      rlActiveTextureSlot(i);
-
-      // Disable texture for active slot
-      if ((i == MATERIAL_MAP_IRRADIANCE) ||
-        (i == MATERIAL_MAP_PREFILTER) ||
-        (i == MATERIAL_MAP_CUBEMAP)) rlDisableTextureCubemap();
-      else rlDisableTexture();
-    }
-  }
+  UnbindMaterialMaps(material);
 
   // Disable all possible vertex array objects (or VBOs)
   rlDisableVertexArray();
@@ -589,84 +1213,286 @@ void gfx::Batch::draw(const Material& material)
   // Disable shader program
   rlDisableShader();
 
-  // Remove instance transforms buffer
-  RL_FREE(instanceTransforms);
+  return _live;
 }
 
 
-void gfx::Batch::setup(raylib::MeshUnmanaged&& mesh, FlatShader* shader)
+size_t gfx::Batch::drawEdges(const Material& material, const FlatShader& shader, Vector3 viewPosition)
+{
+  if (!_count || !_edgeVertexCount)
+    return 0;
+
+  rlEnableShader(material.shader.id);
+
+  rlSetUniform(shader.locationElevation, &_elevation, RL_SHADER_UNIFORM_FLOAT, 1);
+  rlSetUniform(shader.locationViewPosition, &viewPosition, RL_SHADER_UNIFORM_VEC3, 1);
+  BindMaterialMaps(material);
+
+  Matrix matModelView = MatrixMultiply(rlGetMatrixTransform(), rlGetMatrixModelview());
+  rlSetUniformMatrix(material.shader.locs[SHADER_LOC_MATRIX_MVP], MatrixMultiply(matModelView, rlGetMatrixProjection()));
+
+  rlEnableVertexArray(_edgeVaoID);
+  glDrawArraysInstanced(GL_LINES, 0, _edgeVertexCount, static_cast<GLsizei>(_count));
+
+  UnbindMaterialMaps(material);
+
+  rlDisableVertexArray();
+  rlDisableShader();
+
+  return _live;
+}
+
+void gfx::Batch::setup(raylib::MeshUnmanaged&& mesh, FlatShader* shader, float elevation)
 {
   //glGenVertexArrays(1, &_vaoID);
   _mesh = std::move(mesh);
   _vaoID = mesh.vaoId;
+  _elevation = elevation;
   glBindVertexArray(_vaoID);
 
-  glGenBuffers(3, &_vboIDs[0]);
+  glGenBuffers(2, &_vboIDs[0]);
 
   _vboVertices = _vboIDs[0];
-  _vboTransforms = _vboIDs[1];
-  _vboColorShades = _vboIDs[2];
+  _vboInstances = _vboIDs[1];
   
-  rlEnableVertexBuffer(_vboTransforms);
-  for (unsigned int i = 0; i < 4; i++)
+  /* integer attributes are converted to float without normalization so the shader sees coordinates and indices as they are */
+  rlEnableVertexBuffer(_vboInstances);
+  rlEnableVertexAttribute(shader->locationInstancePosition);
+  rlSetVertexAttribute(shader->locationInstancePosition, 4, GL_SHORT, 0, sizeof(InstanceData), offsetof(InstanceData, x));
+  rlSetVertexAttributeDivisor(shader->locationInstancePosition, 1);
+
+  rlEnableVertexAttribute(shader->locationInstanceShape);
+  rlSetVertexAttribute(shader->locationInstanceShape, 4, RL_UNSIGNED_BYTE, 0, sizeof(InstanceData), offsetof(InstanceData, width));
+  rlSetVertexAttributeDivisor(shader->locationInstanceShape, 1);
+
+  glBindVertexArray(0);
+}
+
+void gfx::Batch::setupEdges(const std::vector<EdgeVertex>& vertices, FlatShader* shader)
+{
+  _edgeVertexCount = static_cast<int>(vertices.size());
+
+  glGenVertexArrays(1, &_edgeVaoID);
+  glBindVertexArray(_edgeVaoID);
+
+  glGenBuffers(1, &_edgeVboID);
+  glBindBuffer(GL_ARRAY_BUFFER, _edgeVboID);
+  glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(EdgeVertex), vertices.data(), GL_STATIC_DRAW);
+
+  rlEnableVertexAttribute(0);
+  rlSetVertexAttribute(0, 3, RL_FLOAT, 0, sizeof(EdgeVertex), offsetof(EdgeVertex, position));
+  rlEnableVertexAttribute(1);
+  rlSetVertexAttribute(1, 1, RL_FLOAT, 0, sizeof(EdgeVertex), offsetof(EdgeVertex, silhouette));
+
+  /* instances come from the buffer shared with the faces */
+  rlEnableVertexBuffer(_vboInstances);
+  rlEnableVertexAttribute(shader->locationInstancePosition);
+  rlSetVertexAttribute(shader->locationInstancePosition, 4, GL_SHORT, 0, sizeof(InstanceData), offsetof(InstanceData, x));
+  rlSetVertexAttributeDivisor(shader->locationInstancePosition, 1);
+
+  rlEnableVertexAttribute(shader->locationInstanceShape);
+  rlSetVertexAttribute(shader->locationInstanceShape, 4, RL_UNSIGNED_BYTE, 0, sizeof(InstanceData), offsetof(InstanceData, width));
+  rlSetVertexAttributeDivisor(shader->locationInstanceShape, 1);
+
+  glBindVertexArray(0);
+}
+
+void gfx::Batch::release()
+{
+  _mesh.Unload();
+  glDeleteBuffers(2, &_vboIDs[0]);
+
+  if (_edgeVaoID)
   {
-    auto baseLocation = shader->locationInstanceTransform;
-    rlEnableVertexAttribute(baseLocation + i);
-    rlSetVertexAttribute(baseLocation + i, 4, RL_FLOAT, 0, sizeof(float16), i * sizeof(Vector4));
-    rlSetVertexAttributeDivisor(baseLocation + i, 1);
+    glDeleteBuffers(1, &_edgeVboID);
+    glDeleteVertexArrays(1, &_edgeVaoID);
   }
+}
 
-  rlEnableVertexBuffer(_vboColorShades);
-  for (unsigned int i = 0; i < 4; i++)
+void gfx::Batch::assign(BatchSlot& slot, const std::vector<InstanceData>& instances, bool changed)
+{
+  if (!changed && slot.size == instances.size() && (slot.offset != BatchSlot::UNALLOCATED || instances.empty()))
+    return;
+
+  if (slot.offset != BatchSlot::UNALLOCATED && instances.size() > slot.capacity)
+    free(slot);
+
+  if (slot.offset == BatchSlot::UNALLOCATED)
   {
-    auto baseLocation = shader->locationColorShade;
-    rlEnableVertexAttribute(baseLocation + i);
-    rlSetVertexAttribute(baseLocation + i, 4, RL_FLOAT, 0, sizeof(float16), i * sizeof(Vector4));
-    rlSetVertexAttributeDivisor(baseLocation + i, 1);
+    if (instances.empty())
+      return;
+
+    slot.capacity = instances.size() + std::max(SLOT_HEADROOM, instances.size() / 4);
+    slot.offset = allocateRange(slot.capacity);
+    slot.size = 0;
+
+    /* headroom of a new slot may hold whatever a previous slot left there */
+    erase(slot.offset + instances.size(), slot.capacity - instances.size());
   }
 
-  glBindVertexArray(0);
+  write(slot.offset, instances.data(), instances.size());
+  if (slot.size > instances.size())
+    erase(slot.offset + instances.size(), slot.size - instances.size());
 
-  //rlBindBuffer(RL_ARRAY_BUFFER, _vboIDs[0]);
-  //rlBufferData(RL_ARRAY_BUFFER, _transformsData.size() * sizeof(float16), _transformsData.data(), RL_STATIC_DRAW);
+  _live = _live - slot.size + instances.size();
+  slot.size = instances.size();
 }
 
-void gfx::Batch::release()
+void gfx::Batch::free(BatchSlot& slot)
 {
-  _mesh.Unload();
-  glDeleteBuffers(3, &_vboIDs[0]);
+  if (slot.offset == BatchSlot::UNALLOCATED)
+    return;
+
+  erase(slot.offset, slot.size);
+  _live -= slot.size;
+  releaseRange(slot.offset, slot.capacity);
+  slot = BatchSlot();
 }
 
-void gfx::Batch::update(const Mesh& mesh)
+size_t gfx::Batch::allocateRange(size_t size)
 {
-  const size_t count = _instanceData.size();
-  
-  rlEnableVertexArray(_vaoID);
+  /* first fit among the released ranges, otherwise the batch grows */
+  for (size_t i = 0; i < _free.size(); ++i)
+  {
+    if (_free[i].second >= size)
+    {
+      const size_t offset = _free[i].first;
+      _free[i].first += size;
+      _free[i].second -= size;
+      if (!_free[i].second)
+        _free.erase(_free.begin() + i);
+      return offset;
+    }
+  }
 
-  //glBindBuffer(GL_ARRAY_BUFFER, _vboVertices);
-  //glBufferData(GL_ARRAY_BUFFER, mesh.vertexCount * sizeof(Vector3), mesh.vertices, GL_STATIC_DRAW);
+  const size_t offset = _count;
+  _count += size;
+  if (_instances.size() < _count)
+    _instances.resize(_count);
+  return offset;
+}
 
-  _transformsData.resize(_instanceData.size());
-  for (int i = 0; i < count; i++)
-    _transformsData[i] = MatrixToFloatV(_instanceData[i].matrix);
-  
-  glBindBuffer(GL_ARRAY_BUFFER, _vboTransforms);
-  glBufferData(GL_ARRAY_BUFFER, _transformsData.size() * sizeof(float16), _transformsData.data(), GL_STATIC_DRAW);
+void gfx::Batch::releaseRange(size_t offset, size_t size)
+{
+  auto it = std::lower_bound(_free.begin(), _free.end(), std::make_pair(offset, size_t(0)));
+  it = _free.insert(it, std::make_pair(offset, size));
+
+  if (it + 1 != _free.end() && it->first + it->second == (it + 1)->first)
+  {
+    it->second += (it + 1)->second;
+    _free.erase(it + 1);
+  }
+
+  if (it != _free.begin() && (it - 1)->first + (it - 1)->second == it->first)
+  {
+    (it - 1)->second += it->second;
+    it = _free.erase(it) - 1;
+  }
+
+  /* a range at the end shrinks the batch instead */
+  if (it->first + it->second == _count)
+  {
+    _count = it->first;
+    _free.erase(it);
+  }
+}
+
+void gfx::Batch::write(size_t offset, const InstanceData* instances, size_t count)
+{
+  /* a piece added to or removed from a layer changes a few instances of its slot, not the whole slot */
+  size_t i = 0;
+  while (i < count)
+  {
+    while (i < count && _instances[offset + i] == instances[i])
+      ++i;
+
+    const size_t begin = i;
+    for (; i < count && !(_instances[offset + i] == instances[i]); ++i)
+      _instances[offset + i] = instances[i];
+
+    if (i > begin)
+      markDirty(offset + begin, offset + i);
+  }
+}
+
+void gfx::Batch::erase(size_t offset, size_t count)
+{
+  const InstanceData empty = InstanceData();
+
+  size_t i = 0;
+  while (i < count)
+  {
+    while (i < count && _instances[offset + i] == empty)
+      ++i;
+
+    const size_t begin = i;
+    for (; i < count && !(_instances[offset + i] == empty); ++i)
+      _instances[offset + i] = empty;
+
+    if (i > begin)
+      markDirty(offset + begin, offset + i);
+  }
+}
+
+void gfx::Batch::markDirty(size_t begin, size_t end)
+{
+  auto it = std::lower_bound(_dirty.begin(), _dirty.end(), std::make_pair(begin, size_t(0)));
+
+  if (it != _dirty.begin() && (it - 1)->second + DIRTY_GAP >= begin)
+  {
+    --it;
+    it->second = std::max(it->second, end);
+  }
+  else
+    it = _dirty.insert(it, std::make_pair(begin, end));
 
-  _colorShadesData.resize(_instanceData.size());
-  for (int i = 0; i < count; ++i)
+  while (it + 1 != _dirty.end() && (it + 1)->first <= it->second + DIRTY_GAP)
   {
-    for (int j = 0; j < 4; ++j)
+    it->second = std::max(it->second, (it + 1)->second);
+    _dirty.erase(it + 1);
+  }
+
+  /* the two ranges with the smallest gap between them become one so that uploads stay a handful of calls */
+  if (_dirty.size() > MAX_DIRTY_RANGES)
+  {
+    size_t closest = 0;
+    for (size_t i = 1; i + 1 < _dirty.size(); ++i)
+      if (_dirty[i + 1].first - _dirty[i].second < _dirty[closest + 1].first - _dirty[closest].second)
+        closest = i;
+
+    _dirty[closest].second = _dirty[closest + 1].second;
+    _dirty.erase(_dirty.begin() + closest + 1);
+  }
+}
+
+void gfx::Batch::update()
+{
+  if (_dirty.empty() && _count <= _capacity)
+    return;
+
+  rlEnableVertexArray(_vaoID);
+  glBindBuffer(GL_ARRAY_BUFFER, _vboInstances);
+
+  /* buffers grow geometrically, the old storage is orphaned so the driver doesn't wait for draws still using it,
+     the new storage is filled whole so that it keeps matching the instances kept on this side */
+  if (_count > _capacity)
+  {
+    _capacity = std::max(_count, _capacity * 2);
+    _instances.resize(_capacity);
+    glBufferData(GL_ARRAY_BUFFER, _capacity * sizeof(InstanceData), _instances.data(), GL_DYNAMIC_DRAW);
+    _uploaded = _capacity * sizeof(InstanceData);
+  }
+  else
+  {
+    for (const auto& range : _dirty)
     {
-      _colorShadesData[i].v[j * 4 + 0] = _instanceData[i].color->colors[j].r / 255.0f;
-      _colorShadesData[i].v[j * 4 + 1] = _instanceData[i].color->colors[j].g / 255.0f;
-      _colorShadesData[i].v[j * 4 + 2] = _instanceData[i].color->colors[j].b / 255.0f;
-      _colorShadesData[i].v[j * 4 + 3] = _instanceData[i].color->colors[j].a / 255.0f;
+      const size_t size = (range.second - range.first) * sizeof(InstanceData);
+      glBufferSubData(GL_ARRAY_BUFFER, range.first * sizeof(InstanceData), size, _instances.data() + range.first);
+      _uploaded += size;
     }
   }
-  
-  glBindBuffer(GL_ARRAY_BUFFER, _vboColorShades);
-  glBufferData(GL_ARRAY_BUFFER, count * sizeof(float16), _colorShadesData.data(), GL_STATIC_DRAW);
+
+  _dirty.clear();
 
   rlDisableVertexBuffer();
   rlDisableVertexArray();
@@ -5,16 +5,62 @@
 #include "Model.hpp"
 #include "Shader.hpp"
 #include "Camera3D.hpp"
+#include "RenderTexture.hpp"
 
 #include "model/model.h"
 #include "defines.h"
 
 namespace gfx
 {
+  /* packed per instance data, the vertex shader rebuilds the transform from it and looks the color up in the palette,
+     instances with a zero width are empty and get clipped, they fill the headroom of batch slots */
   struct InstanceData
   {
-    Matrix matrix;
-    const nb::PieceColor* color;
+    /* stud holding the center in layer space and index of the layer, flags tell whether the center lies half a stud
+       further on each axis so that the whole range of piece coordinates fits */
+    int16_t x, y;
+    int16_t layer;
+    int16_t unused;
+    /* size in studs which scales the mesh and palette index of the color */
+    uint8_t width, height;
+    nb::palette_index_t color;
+    uint8_t flags;
+
+    static constexpr uint8_t HALF_X = 0x01;
+    static constexpr uint8_t HALF_Y = 0x02;
+
+    /* instance centered on the area of the given size with its corner at coord */
+    static InstanceData centeredOn(coord2d_t coord, size2d_t size, layer_index_t layer, nb::palette_index_t color)
+    {
+      return {
+        static_cast<int16_t>(coord.x + size.width / 2), static_cast<int16_t>(coord.y + size.height / 2),
+        static_cast<int16_t>(layer), 0,
+        static_cast<uint8_t>(size.width), static_cast<uint8_t>(size.height), color,
+        static_cast<uint8_t>(((size.width & 1) ? HALF_X : 0) | ((size.height & 1) ? HALF_Y : 0))
+      };
+    }
+
+    bool operator==(const InstanceData& other) const = default;
+  };
+
+  static_assert(sizeof(InstanceData) == 12, "instance data must stay packed");
+
+  /* vertex of the line list outlining a shape, silhouette is the signed radius of lines which face the camera */
+  struct EdgeVertex
+  {
+    Vector3 position;
+    float silhouette;
+  };
+
+  /* range of a batch owned by one layer, it keeps its offset while its instances fit in it so that a change in
+     the number of instances of a layer doesn't move the ones of other layers */
+  struct BatchSlot
+  {
+    static constexpr size_t UNALLOCATED = ~size_t(0);
+
+    size_t offset = UNALLOCATED;
+    size_t size = 0;
+    size_t capacity = 0;
   };
 
   class Batch
@@ -22,27 +68,73 @@ namespace gfx
     raylib::MeshUnmanaged _mesh;
     
     unsigned int _vaoID;
-    unsigned int _vboIDs[3];
+    unsigned int _vboIDs[2];
+
+    unsigned int _vboVertices, _vboInstances;
 
-    unsigned int _vboVertices, _vboTransforms, _vboColorShades;
+    /* height of the mesh center above the base of its layer */
+    float _elevation = 0.0f;
+
+    /* line list outlining the mesh, drawn with the same instance buffer */
+    unsigned int _edgeVaoID = 0;
+    unsigned int _edgeVboID = 0;
+    int _edgeVertexCount = 0;
   
-    /* per instance data */
-    std::vector<float16> _colorShadesData;
-    std::vector<float16> _transformsData;
+    /* per instance data, kept across frames as a copy of what the GPU buffer holds, it spans the whole buffer so
+       that writes can skip the instances which are already there */
+    std::vector<InstanceData> _instances;
+
+    /* end of the last allocated slot, instances are drawn up to here, and instances the GPU buffer can hold */
+    size_t _count = 0;
+    size_t _capacity = 0;
+    /* instances stored in the slots, without their headroom */
+    size_t _live = 0;
+    /* ranges given back by slots as (offset, size), sorted by offset and merged with their neighbours */
+    std::vector<std::pair<size_t, size_t>> _free;
 
-    std::vector<InstanceData> _instanceData;
+    /* ranges of instances written since the last upload as [begin, end), sorted and apart from each other */
+    std::vector<std::pair<size_t, size_t>> _dirty;
+    size_t _uploaded = 0;
 
-    void update(const Mesh& mesh);
+    /* stores instances at offset, only the runs which differ from the ones already there are marked dirty */
+    void write(size_t offset, const InstanceData* instances, size_t count);
+    /* fills a range with empty instances */
+    void erase(size_t offset, size_t count);
+    void markDirty(size_t begin, size_t end);
+    size_t allocateRange(size_t size);
+    void releaseRange(size_t offset, size_t size);
+    void update();
 
   public:
     ~Batch();
 
-    void setup(raylib::MeshUnmanaged&& mesh, FlatShader* shader);
+    void setup(raylib::MeshUnmanaged&& mesh, FlatShader* shader, float elevation);
+    void setupEdges(const std::vector<EdgeVertex>& vertices, FlatShader* shader);
     void release();
-    void draw(const Material& material);
+
+    /* minimum room left for growth when a slot is allocated or moved */
+    static constexpr size_t SLOT_HEADROOM = 16;
+    /* dirty ranges closer than this are uploaded together, past the limit the closest ones are merged */
+    static constexpr size_t DIRTY_GAP = 16;
+    static constexpr size_t MAX_DIRTY_RANGES = 32;
+
+    /* stores the instances of a slot if they changed, the slot is written in place and moves only when the instances
+       outgrow its capacity, only the instances which differ from the previous ones are uploaded */
+    void assign(BatchSlot& slot, const std::vector<InstanceData>& instances, bool changed);
+    /* gives the range of a slot back to the batch */
+    void free(BatchSlot& slot);
+
+    /* uploads the dirty ranges of the instances and draws them with a single call, returns how many instances
+       of the slots were drawn */
+    size_t draw(const Material& material, const FlatShader& shader);
+    /* draws the outlines of the instances uploaded by the last draw with a single call */
+    size_t drawEdges(const Material& material, const FlatShader& shader, Vector3 viewPosition);
 
     auto& mesh() { return _mesh; }
-    auto& instanceData() { return _instanceData; }
+    /* instances drawn by a call, including the empty ones in the headroom of slots */
+    size_t extent() const { return _count; }
+    /* bytes sent to the GPU by the last draw */
+    size_t uploaded() const { return _uploaded; }
   };
 
   class TopDownGrid
@@ -58,13 +150,35 @@ namespace gfx
 
     nb::layer_iterator_t begin() const;
     nb::layer_iterator_t end() const;
+
+    /* cells shown by the grids, model bounds with a margin that never shrinks below the minimum layer size */
+    bounds2d_t area() const;
+    /* screen rectangle of the grid shown at given position from top */
+    rect screenBounds(layer_index_t relative) const;
   };
 
   class Renderer
   {
   public:
-    
+    /* edges are either drawn as instanced lines or found in screen space where piece ids and normals change,
+       the latter costs the same whatever the number of pieces */
+    enum class EdgeMode
+    {
+      Geometry,
+      ScreenSpace
+    };
 
+    /* counters of the last frame, every piece is expected to be either drawn as exactly one instance or culled */
+    struct FrameStats
+    {
+      size_t pieces = 0;
+      size_t instances = 0;
+      size_t studs = 0;
+      size_t culledPieces = 0;
+      size_t culledStuds = 0;
+      size_t drawCalls = 0;
+      size_t uploadedBytes = 0;
+    };
 
   protected:
     Context* _context;
@@ -77,32 +191,118 @@ namespace gfx
 
     std::vector<Batch*> _shapeBatches;
 
+    /* instances of the pieces whose first cell falls in one occupancy chunk of a layer, each chunk has its own
+       slots so that an edit rebuilds and uploads only the chunks around it */
+    struct ChunkCache
+    {
+      /* coordinates of the chunk, see OccupancyIndex::chunkOf */
+      coord2d_t position;
+
+      std::vector<InstanceData> cubes;
+      std::vector<InstanceData> cylinders;
+      std::vector<InstanceData> studs;
+
+      /* pieces enclosed by their neighbours and studs covered by the layer above, left out of the instances */
+      size_t culledPieces = 0;
+      size_t culledStuds = 0;
+
+      BatchSlot cubesSlot;
+      BatchSlot cylindersSlot;
+      BatchSlot studsSlot;
+    };
+
+    /* instance data of a layer, kept by layer id so that inserting or removing a layer only relabels the
+       instances of the layers which moved, versions are never shared so they can't match by chance either */
+    struct LayerCache
+    {
+      bool built = false;
+      uint64_t version = 0;
+      layer_index_t index = 0;
+      /* frame in which the layer was last seen, caches of layers which are gone are dropped */
+      uint64_t frame = 0;
+
+      /* layers next to this one when it was built, they decide what is hidden */
+      layer_id_t below = nb::LayerOrder::NIL;
+      layer_id_t above = nb::LayerOrder::NIL;
+      uint64_t belowVersion = 0;
+      uint64_t aboveVersion = 0;
+
+      /* by OccupancyIndex::key of the chunk */
+      std::unordered_map<uint64_t, ChunkCache> chunks;
+
+      size_t culledPieces = 0;
+      size_t culledStuds = 0;
+    };
+
+    std::unordered_map<layer_id_t, LayerCache> _layerCaches;
+
+    /* areas edited since the last frame in layer space by layer id, read from the model journal */
+    std::unordered_map<layer_id_t, std::vector<bounds2d_t>> _editedAreas;
+    /* edits over this share of the pieces of a layer rebuild it whole instead of looking up their neighbours */
+    static constexpr size_t REBUILD_RATIO = 4;
+    uint64_t _journalId = 0;
+    uint64_t _journalCursor = 0;
+    uint64_t _frame = 0;
+
+    FrameStats _stats;
+    EdgeMode _edgeMode = EdgeMode::Geometry;
+
+    /* id, palette index and normal of the piece visible in each pixel, used by the screen space edge mode */
+    raylib::RenderTexture _idTarget;
+    raylib::ShaderUnmanaged _outlineShader;
+    int _outlineLocationIds = -1;
+    int _outlineLocationPalette = -1;
+    unsigned int _outlineVaoID = 0;
+
+    /* 4 shades for each palette index, uploaded again only when colors are added */
+    unsigned int _paletteTexture = 0;
+    size_t _paletteSize = 0;
+
     struct Shaders
     {
       FlatShader flatShading;
+      FlatShader edgeShading;
+      FlatShader idShading;
     } shaders;
 
     struct Materials
     {
       raylib::Material flatMaterial;
+      raylib::Material edgeMaterial;
+      raylib::Material idMaterial;
     } materials;
 
   public:
     static constexpr int EDGE_COMPLEXITY = 6;
-    static constexpr int MOCK_LAYER_SIZE = 16;
+    static constexpr int MIN_LAYER_SIZE = 16;
+    static constexpr int GRID_MARGIN = 2;
 
     void render(const nb::Model* model);
 
     auto& camera() { return _camera; }
+    const FrameStats& stats() const { return _stats; }
+
+    EdgeMode edgeMode() const { return _edgeMode; }
+    void setEdgeMode(EdgeMode mode) { _edgeMode = mode; }
 
   protected:
 
-    void prepareStudsForPiece(const nb::Piece* piece, const raylib::Matrix& layerTransform);
+    void updatePalette();
+    /* returns how many studs were left out because the layer above covers them */
+    size_t prepareStudsForPiece(const nb::Piece* piece, const nb::Layer* above, layer_index_t index, std::vector<InstanceData>& studs);
+    void prepareChunk(const nb::Layer* layer, const nb::Layer* below, const nb::Layer* above, layer_index_t index, coord_t cx, coord_t cy, LayerCache& cache);
+    void freeChunk(ChunkCache& chunk);
+    /* collects the areas edited since last frame, returns false if they are unknown and every layer must be rebuilt */
+    bool readJournal(const nb::Model* model);
     
-    void renderLayerGrid3d(layer_index_t index, size2d_t size);
-    void renderLayer(const nb::Layer* layer);
+    void renderLayerGrid3d(layer_index_t index, const bounds2d_t& area);
+    /* queues the instances of a layer, batches are drawn once all layers are queued */
+    void renderLayer(const nb::Layer* layer, layer_index_t index, LayerCache& cache, bool journaled);
     void renderModel(const nb::Model* model);
-    void renderStuds();
+    void drawBatches();
+    void updateIdTarget();
+    /* draws ids and normals offscreen and outlines their discontinuities with a single full screen pass */
+    void renderOutlines();
 
   public:
     Renderer(Context* context);
@@ -112,6 +312,6 @@ namespace gfx
     void deinit();
 
     TopDownGrid _topDown;
-    void renderLayerGrid2d(vec2 base, const nb::Layer* layer, size2d_t layerSize, size2d_t cellSize);
+    void renderLayerGrid2d(vec2 base, layer_index_t index, const bounds2d_t& area, size2d_t cellSize);
   };
 }
@@ -7,6 +7,11 @@
 #include "rlImGui.h"
 
 #include "model/piece.h"
+#include "model/model.h"
+#include "loader.h"
+#include "renderer.h"
+#include "model/history.h"
+#include "model/inventory.h"
 
 #include <optional>
 
@@ -219,7 +224,12 @@ void UI::drawToolbar()
   bool ctrl = io.KeyCtrl;
   if (ctrl && ImGui::IsKeyPressed(ImGuiKey_N)) {/* new */ }
   if (ctrl && ImGui::IsKeyPressed(ImGuiKey_O)) {/* open */ }
-  if (ctrl && ImGui::IsKeyPressed(ImGuiKey_S)) {/* save */ }
+  if (ctrl && ImGui::IsKeyPressed(ImGuiKey_S))
+    _context->loader->saveInBackground(_context->model->snapshot(), _context->prefs.basePath + "/model.yml");
+  if (ctrl && ImGui::IsKeyPressed(ImGuiKey_I))
+    fitToInventory();
+  if (ctrl && ImGui::IsKeyPressed(ImGuiKey_E))
+    toggleEdgeMode();
   if (ImGui::IsKeyPressed(ImGuiKey_Space)) {/* play/pause toggle */ }
   if (io.KeyShift && ImGui::IsKeyPressed(ImGuiKey_Space)) {/* stop */ }
 
@@ -227,6 +237,18 @@ void UI::drawToolbar()
   ImGui::PopStyleVar();
 }
 
+void UI::fitToInventory()
+{
+  auto inventory = _context->loader->loadInventory(_context->prefs.basePath + "/inventory.yml");
+  if (!inventory)
+    return;
+
+  auto solution = nb::InventorySolver::solve(*_context->model, *inventory);
+  _context->history->apply(*_context->model, solution.batch);
+
+  TraceLog(LOG_INFO, "Replaced %d pieces with stocked parts, %d pieces can't be made from the inventory", static_cast<int>(solution.replaced), static_cast<int>(solution.unresolved.size()));
+}
+
 void UI::draw()
 {
   drawPaletteWindow();
@@ -235,4 +257,11 @@ void UI::draw()
     drawStudModeWindow();
 
   drawToolbar();
-}
\ No newline at end of file
+}
+
+void UI::toggleEdgeMode()
+{
+  auto* renderer = _context->renderer.get();
+  using EdgeMode = gfx::Renderer::EdgeMode;
+  renderer->setEdgeMode(renderer->edgeMode() == EdgeMode::Geometry ? EdgeMode::ScreenSpace : EdgeMode::Geometry);
+}
@@ -27,5 +27,10 @@ public:
   void drawStudModeWindow();
   void drawToolbar();
 
+  /* replaces pieces which exceed the inventory with stocked parts */
+  void fitToInventory();
+  /* switches between instanced edge geometry and screen space outlines */
+  void toggleEdgeMode();
+
   void draw();
 };
@@ -0,0 +1,121 @@
+#include "model/brickify.h"
+#include "check.h"
+
+#include <random>
+#include <vector>
+
+using namespace nb;
+using test::check;
+
+namespace
+{
+  /* true if the bricks cover every occupied cell of the volume exactly once with the color of the cell */
+  bool covers(const VoxelVolume& volume, const std::vector<PieceRecord>& bricks)
+  {
+    const size2d_t size = volume.size();
+    std::vector<uint8_t> seen(size_t(size.width) * size.height * volume.layerCount(), 0);
+
+    for (const PieceRecord& record : bricks)
+    {
+      const Piece& brick = record.piece;
+      for (coord_t y = brick.y(); y < brick.y() + brick.height(); ++y)
+      {
+        for (coord_t x = brick.x(); x < brick.x() + brick.width(); ++x)
+        {
+          if (!volume.occupied(x, y, record.layer) || volume.at(x, y, record.layer) != brick.colorIndex())
+            return false;
+
+          uint8_t& cell = seen[(size_t(record.layer) * size.height + y) * size.width + x];
+          if (cell++)
+            return false;
+        }
+      }
+    }
+
+    for (layer_index_t z = 0; z < volume.layerCount(); ++z)
+      for (coord_t y = 0; y < size.height; ++y)
+        for (coord_t x = 0; x < size.width; ++x)
+          if (volume.occupied(x, y, z) && !seen[(size_t(z) * size.height + y) * size.width + x])
+            return false;
+
+    return true;
+  }
+}
+
+int main()
+{
+  /* bricks take their color from the palette, cells of unknown colors would be lost */
+  static PieceColor red, blue;
+  const palette_index_t r = Palette::global().add(&red), b = Palette::global().add(&blue);
+
+  /* a solid 4x2 block is a single brick */
+  {
+    VoxelVolume volume(size2d_t(4, 2), 1);
+    for (coord_t y = 0; y < 2; ++y)
+      for (coord_t x = 0; x < 4; ++x)
+        volume.set(x, y, 0, r);
+
+    auto bricks = Brickifier().brickify(volume);
+    check(bricks.size() == 1 && bricks[0].piece.width() == 4 && bricks[0].piece.height() == 2, "solid block becomes one brick");
+  }
+
+  /* bricks never mix colors */
+  {
+    VoxelVolume volume(size2d_t(4, 2), 1);
+    for (coord_t y = 0; y < 2; ++y)
+      for (coord_t x = 0; x < 4; ++x)
+        volume.set(x, y, 0, x < 2 ? r : b);
+
+    auto bricks = Brickifier().brickify(volume);
+    check(bricks.size() == 2 && covers(volume, bricks), "two colors give one brick each");
+  }
+
+  /* a catalog without the needed sizes still covers the volume with 1x1 bricks */
+  {
+    VoxelVolume volume(size2d_t(3, 3), 1);
+    for (coord_t y = 0; y < 3; ++y)
+      for (coord_t x = 0; x < 3; ++x)
+        volume.set(x, y, 0, r);
+
+    auto bricks = Brickifier({ size2d_t(2, 2) }).brickify(volume);
+    check(covers(volume, bricks) && bricks.size() == 6, "2x2 catalog covers a 3x3 square with one 2x2 and five 1x1");
+  }
+
+  /* stacked layers of a wall don't line their joints up */
+  {
+    VoxelVolume volume(size2d_t(12, 1), 2);
+    for (layer_index_t z = 0; z < 2; ++z)
+      for (coord_t x = 0; x < 12; ++x)
+        volume.set(x, 0, z, r);
+
+    auto bricks = Brickifier().brickify(volume);
+
+    std::vector<coord_t> joints[2];
+    for (const PieceRecord& record : bricks)
+      if (record.piece.x() > 0)
+        joints[record.layer].push_back(record.piece.x());
+
+    bool staggered = covers(volume, bricks) && !joints[1].empty();
+    for (coord_t joint : joints[1])
+      for (coord_t other : joints[0])
+        staggered = staggered && joint != other;
+
+    check(staggered, "joints of the second layer don't lie over the ones of the first");
+  }
+
+  /* random volumes large enough to be split among threads are covered exactly */
+  {
+    std::mt19937 rng(7);
+    VoxelVolume volume(size2d_t(64, 64), 20);
+    for (layer_index_t z = 0; z < volume.layerCount(); ++z)
+      for (coord_t y = 0; y < 64; ++y)
+        for (coord_t x = 0; x < 64; ++x)
+          if (rng() % 4)
+            volume.set(x, y, z, rng() % 2 ? r : b);
+
+    check(size_t(64) * 64 * 20 >= Brickifier::PARALLEL_CELLS, "volume is brickified by workers");
+    check(covers(volume, Brickifier().brickify(volume)), "random volume is covered exactly once");
+  }
+
+  return test::finish("brickify");
+}
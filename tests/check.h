@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdio>
+
+/* minimal harness shared by the tests, failed checks are printed and turn into a non zero exit code for ctest */
+namespace test
+{
+  inline int failures = 0;
+
+  inline void check(bool condition, const char* what)
+  {
+    if (!condition)
+    {
+      std::printf("FAILED: %s\n", what);
+      ++failures;
+    }
+  }
+
+  /* exit code of a test once all its checks ran */
+  inline int finish(const char* name)
+  {
+    if (!failures)
+      std::printf("%s: all checks passed\n", name);
+
+    return failures ? 1 : 0;
+  }
+}
@@ -0,0 +1,109 @@
+#include "model/model.h"
+#include "model/connectivity.h"
+#include "check.h"
+
+using namespace nb;
+using test::check;
+
+namespace
+{
+  Piece brick(coord_t x, coord_t y, size2d_t size = size2d_t(2, 2), StudMode studs = StudMode::Full)
+  {
+    return Piece(coord2d_t(x, y), nullptr, PieceOrientation::North, PieceType::Square, size, studs);
+  }
+}
+
+int main()
+{
+  /* a staircase hangs from the bottom layer and falls apart when its middle step is removed */
+  {
+    nb::Model model;
+    model.prepareLayers(3);
+    PieceHandle bottom = model.addPiece(0, brick(0, 0));
+    PieceHandle middle = model.addPiece(1, brick(1, 0));
+    PieceHandle top = model.addPiece(2, brick(2, 0));
+
+    Connectivity connectivity;
+    connectivity.update(model);
+    check(!connectivity.floating(model, bottom) && !connectivity.floating(model, middle) && !connectivity.floating(model, top), "staircase is grounded");
+
+    model.remove(middle);
+    connectivity.update(model);
+    check(!connectivity.floating(model, bottom), "bottom step stays grounded");
+    check(connectivity.floating(model, top), "top step floats once the middle one is gone");
+
+    PieceHandle bridge = model.addPiece(1, brick(0, 0, size2d_t(4, 2)));
+    connectivity.update(model);
+    check(!connectivity.floating(model, top) && !connectivity.floating(model, bridge), "bridge grounds the top step again");
+  }
+
+  /* a removal leaving another path to the ground doesn't split the component */
+  {
+    nb::Model model;
+    model.prepareLayers(3);
+    model.addPiece(0, brick(0, 0, size2d_t(8, 2)));
+    PieceHandle left = model.addPiece(1, brick(0, 0));
+    model.addPiece(1, brick(6, 0));
+    PieceHandle top = model.addPiece(2, brick(0, 0, size2d_t(8, 2)));
+
+    Connectivity connectivity;
+    connectivity.update(model);
+
+    model.remove(left);
+    connectivity.update(model);
+    check(!connectivity.floating(model, top), "top stays grounded through the other pillar");
+  }
+
+  /* pieces without studs hold nothing */
+  {
+    nb::Model model;
+    model.prepareLayers(2);
+    model.addPiece(0, brick(0, 0, size2d_t(2, 2), StudMode::None));
+    PieceHandle above = model.addPiece(1, brick(0, 0));
+
+    Connectivity connectivity;
+    connectivity.update(model);
+    check(connectivity.floating(model, above), "piece over a tile floats");
+  }
+
+  /* pieces moved away from their support are tracked through the journal */
+  {
+    nb::Model model;
+    model.prepareLayers(2);
+    model.addPiece(0, brick(0, 0));
+    PieceHandle above = model.addPiece(1, brick(0, 0));
+
+    Connectivity connectivity;
+    connectivity.update(model);
+
+    model.move(above, coord2d_t(10, 0));
+    connectivity.update(model);
+    check(connectivity.floating(model, above), "piece moved off its support floats");
+
+    model.move(above, coord2d_t(-9, 0));
+    connectivity.update(model);
+    check(!connectivity.floating(model, above), "piece moved back over the support is grounded");
+  }
+
+  /* a model loaded in place of another one is followed from scratch even if its journal could match the old cursor */
+  {
+    nb::Model model;
+    model.prepareLayers(2);
+    model.addPiece(0, brick(0, 0));
+    model.addPiece(1, brick(0, 0));
+
+    Connectivity connectivity;
+    connectivity.update(model);
+
+    model = nb::Model();
+    model.prepareLayers(2);
+    PieceHandle floating = model.addPiece(1, brick(50, 50));
+    for (coord_t x = 0; x < 6; x += 2)
+      model.addPiece(0, brick(x, 0));
+
+    connectivity.update(model);
+    check(connectivity.floating(model, floating), "piece of the new model floats");
+  }
+
+  return test::finish("connectivity");
+}
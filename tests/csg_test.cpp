@@ -0,0 +1,83 @@
+#include "model/model.h"
+#include "model/csg.h"
+#include "check.h"
+
+using namespace nb;
+using test::check;
+
+namespace
+{
+  Piece brick(coord2d_t coord, size2d_t size, const PieceColor* color)
+  {
+    return Piece(coord, color, PieceOrientation::North, PieceType::Square, size);
+  }
+
+  /* total area of the pieces of a layer, equal to the covered cells only if no pieces overlap */
+  size_t area(const Layer* layer)
+  {
+    size_t total = 0;
+    for (const Piece& piece : layer->pieces())
+      total += size_t(piece.width()) * piece.height();
+    return total;
+  }
+
+  size_t covered(const Layer* layer, const bounds2d_t& bounds) { return layer->occupancy().count(bounds); }
+}
+
+int main()
+{
+  /* cut cells are dropped by brickification if their color isn't in the palette */
+  static PieceColor color;
+  Palette::global().add(&color);
+
+  /* a 2x2 hole in the corner of a 4x4 brick leaves 12 cells rebuilt from smaller bricks */
+  {
+    nb::Model a, b;
+    a.addLayerOnTop();
+    b.addLayerOnTop();
+    a.addPiece(0, brick(coord2d_t(0, 0), size2d_t(4, 4), &color));
+    b.addPiece(0, brick(coord2d_t(0, 0), size2d_t(2, 2), &color));
+
+    nb::Model result = Csg::subtract(a, b);
+    const Layer* layer = result.layer(0);
+
+    check(area(layer) == 12, "subtract leaves 12 cells of bricks");
+    check(covered(layer, bounds2d_t(coord2d_t(0, 0), coord2d_t(4, 4))) == 12, "remaining bricks don't overlap");
+    check(covered(layer, bounds2d_t(coord2d_t(0, 0), coord2d_t(2, 2))) == 0, "subtracted cells are empty");
+  }
+
+  /* union keeps the pieces of a and fills the rest of b, across both layers of b */
+  {
+    nb::Model a, b;
+    a.addLayerOnTop();
+    b.prepareLayers(2);
+    a.addPiece(0, brick(coord2d_t(0, 0), size2d_t(2, 2), &color));
+    b.addPiece(0, brick(coord2d_t(0, 0), size2d_t(4, 4), &color));
+    b.addPiece(1, brick(coord2d_t(1, 1), size2d_t(2, 2), &color));
+
+    nb::Model result = Csg::unite(a, b);
+
+    check(result.layerCount() == 2, "union has the layers of both models");
+    check(result.piece(coord3d_t(coord2d_t(0, 0), 0)) && result.piece(coord3d_t(coord2d_t(0, 0), 0))->width() == 2, "pieces of a are kept");
+    check(area(result.layer(0)) == 16 && covered(result.layer(0), bounds2d_t(coord2d_t(0, 0), coord2d_t(4, 4))) == 16, "first layer is filled without overlaps");
+    check(area(result.layer(1)) == 4, "second layer comes from b alone");
+  }
+
+  /* far apart cuts are rebuilt independently */
+  {
+    nb::Model a, b;
+    a.addLayerOnTop();
+    b.addLayerOnTop();
+    a.addPiece(0, brick(coord2d_t(0, 0), size2d_t(2, 2), &color));
+    a.addPiece(0, brick(coord2d_t(1000, 1000), size2d_t(2, 2), &color));
+    b.addPiece(0, brick(coord2d_t(0, 0), size2d_t(1, 1), &color));
+    b.addPiece(0, brick(coord2d_t(1000, 1000), size2d_t(1, 1), &color));
+
+    nb::Model result = Csg::subtract(a, b);
+
+    check(area(result.layer(0)) == 6, "each cut keeps its 3 cells");
+    check(!result.piece(coord3d_t(coord2d_t(0, 0), 0)) && !result.piece(coord3d_t(coord2d_t(1000, 1000), 0)), "cut cells are empty");
+  }
+
+  return test::finish("csg");
+}
@@ -0,0 +1,108 @@
+#include "model/diff.h"
+#include "check.h"
+
+using namespace nb;
+using test::check;
+
+namespace
+{
+  Piece brick(coord_t x, coord_t y, const PieceColor* color, size2d_t size = size2d_t(2, 2))
+  {
+    return Piece(coord2d_t(x, y), color, PieceOrientation::North, PieceType::Square, size);
+  }
+
+  /* base model shared by the merges, three pieces apart from each other on one layer */
+  nb::Model base(const PieceColor* color)
+  {
+    nb::Model model;
+    model.addLayerOnTop();
+    model.addPiece(0, brick(0, 0, color));
+    model.addPiece(0, brick(10, 0, color));
+    model.addPiece(0, brick(20, 0, color));
+    return model;
+  }
+
+  PieceHandle at(const nb::Model& model, coord_t x, coord_t y) { return model.handle(coord3d_t(coord2d_t(x, y), 0)); }
+}
+
+int main()
+{
+  static PieceColor red, blue;
+  Palette::global().add(&red);
+  Palette::global().add(&blue);
+
+  /* each kind of change is told apart */
+  {
+    nb::Model from = base(&red), to = base(&red);
+    to.move(at(to, 0, 0), coord2d_t(0, 5));
+    to.recolor(at(to, 10, 0), &blue);
+    to.remove(at(to, 20, 0));
+    to.addPiece(0, brick(30, 0, &red, size2d_t(1, 1)));
+
+    Diff diff = Diff::compute(from, to);
+    check(diff.entries.size() == 4, "four changes are found");
+    check(diff.count(ChangeType::Moved) == 1 && diff.count(ChangeType::Recolored) == 1 &&
+      diff.count(ChangeType::Removed) == 1 && diff.count(ChangeType::Added) == 1, "one change of each kind");
+    check(Diff::compute(from, from).entries.empty(), "model doesn't differ from itself");
+  }
+
+  /* pieces moved by a shift of the model are unchanged in world space */
+  {
+    nb::Model from = base(&red), to = base(&red);
+    to.shift(coord2d_t(3, 0));
+    check(Diff::compute(from, to).count(ChangeType::Moved) == 3, "shift moves every piece");
+  }
+
+  /* changes to different pieces are all merged */
+  {
+    nb::Model b = base(&red), ours = base(&red), theirs = base(&red);
+    ours.move(at(ours, 0, 0), coord2d_t(0, 5));
+    theirs.recolor(at(theirs, 10, 0), &blue);
+    theirs.remove(at(theirs, 20, 0));
+
+    Merge merge = Merge::compute(b, ours, theirs);
+    check(merge.conflicts.empty(), "independent changes don't conflict");
+    check(merge.result.piece(coord3d_t(coord2d_t(0, 5), 0)).has_value(), "our movement is kept");
+    check(merge.result.piece(coord3d_t(coord2d_t(10, 0), 0))->color() == &blue, "their recolor is kept");
+    check(!merge.result.piece(coord3d_t(coord2d_t(20, 0), 0)), "their removal is kept");
+  }
+
+  /* a piece changed differently by both sides keeps our change */
+  {
+    nb::Model b = base(&red), ours = base(&red), theirs = base(&red);
+    ours.move(at(ours, 0, 0), coord2d_t(0, 5));
+    theirs.recolor(at(theirs, 0, 0), &blue);
+
+    Merge merge = Merge::compute(b, ours, theirs);
+    check(merge.conflicts.size() == 1 && merge.conflicts[0].type == Merge::ConflictType::Modified, "different changes to a piece conflict");
+    auto kept = merge.result.piece(coord3d_t(coord2d_t(0, 5), 0));
+    check(kept && kept->color() == &red && merge.result.layer(0)->pieces().size() == 3, "our change wins");
+  }
+
+  /* the same change on both sides isn't a conflict */
+  {
+    nb::Model b = base(&red), ours = base(&red), theirs = base(&red);
+    ours.remove(at(ours, 10, 0));
+    theirs.remove(at(theirs, 10, 0));
+    ours.addPiece(0, brick(40, 0, &red));
+    theirs.addPiece(0, brick(40, 0, &red));
+
+    Merge merge = Merge::compute(b, ours, theirs);
+    check(merge.conflicts.empty() && merge.result.layer(0)->pieces().size() == 3, "equal changes are merged once");
+  }
+
+  /* additions overlapping each other leave theirs out */
+  {
+    nb::Model b = base(&red), ours = base(&red), theirs = base(&red);
+    ours.addPiece(0, brick(40, 0, &red));
+    theirs.addPiece(0, brick(41, 1, &blue));
+
+    Merge merge = Merge::compute(b, ours, theirs);
+    check(merge.conflicts.size() == 1 && merge.conflicts[0].type == Merge::ConflictType::Overlap, "overlapping additions conflict");
+    check(merge.conflicts[0].theirs && merge.conflicts[0].theirs->piece.x() == 41, "conflict reports their piece");
+    auto kept = merge.result.piece(coord3d_t(coord2d_t(41, 1), 0));
+    check(kept && kept->x() == 40 && merge.result.layer(0)->pieces().size() == 4, "our addition is kept");
+  }
+
+  return test::finish("diff");
+}
@@ -0,0 +1,91 @@
+#include "model/model.h"
+#include "model/history.h"
+#include "check.h"
+
+using namespace nb;
+using test::check;
+
+namespace
+{
+  Piece brick(coord_t x, coord_t y)
+  {
+    return Piece(coord2d_t(x, y), nullptr, PieceOrientation::North, PieceType::Square, size2d_t(2, 2));
+  }
+}
+
+int main()
+{
+  /* a movement the model rejects isn't recorded, undo leaves the piece alone */
+  {
+    nb::Model model;
+    model.addLayerOnTop();
+    History history;
+
+    PieceHandle handle = history.add(model, 0, brick(32000, 0));
+
+    EditBatch batch;
+    batch.move(handle, coord2d_t(1000, 0));
+    history.apply(model, batch);
+
+    check(model.piece(handle) && model.piece(handle)->x() == 32000, "move out of range is rejected");
+
+    check(history.undo(model), "rejected move leaves the insertion to undo");
+    check(model.layer(0)->pieces().size() == 0, "undo after a rejected move only removes the inserted piece");
+  }
+
+  /* undoing a rejected move doesn't delete a piece at the position the move would have reached */
+  {
+    nb::Model model;
+    model.addLayerOnTop();
+    History history;
+
+    PieceHandle handle = model.addPiece(0, brick(32000, 0));
+    const coord_t wrapped = static_cast<coord_t>(static_cast<int16_t>(32000 + 1000));
+    model.addPiece(0, brick(wrapped, 0));
+
+    EditBatch batch;
+    batch.move(handle, coord2d_t(1000, 0));
+    history.apply(model, batch);
+
+    check(!history.canUndo(), "batch with only a rejected move records no step");
+    check(model.layer(0)->pieces().size() == 2, "rejected move keeps both pieces");
+  }
+
+  /* a piece both removed and moved by the same batch is recorded once */
+  {
+    nb::Model model;
+    model.addLayerOnTop();
+    History history;
+
+    PieceHandle handle = model.addPiece(0, brick(0, 0));
+
+    EditBatch batch;
+    batch.remove(handle);
+    batch.move(handle, coord2d_t(4, 0));
+    history.apply(model, batch);
+
+    check(model.layer(0)->pieces().size() == 0, "piece is removed");
+    check(history.undo(model), "removal can be undone");
+    check(model.layer(0)->pieces().size() == 1 && model.piece(coord3d_t(coord2d_t(0, 0), 0)), "undo restores the piece once at its position");
+  }
+
+  /* an accepted move is undone and redone */
+  {
+    nb::Model model;
+    model.addLayerOnTop();
+    History history;
+
+    PieceHandle handle = model.addPiece(0, brick(0, 0));
+
+    EditBatch batch;
+    batch.move(handle, coord2d_t(4, 0));
+    batch.move(handle, coord2d_t(2, 0));
+    history.apply(model, batch);
+
+    check(model.piece(coord3d_t(coord2d_t(6, 0), 0)).has_value(), "both movements are applied");
+    check(history.undo(model) && model.piece(coord3d_t(coord2d_t(0, 0), 0)) && model.layer(0)->pieces().size() == 1, "undo moves the piece back");
+    check(history.redo(model) && model.piece(coord3d_t(coord2d_t(6, 0), 0)) && model.layer(0)->pieces().size() == 1, "redo moves it again");
+  }
+
+  return test::finish("history");
+}
@@ -0,0 +1,88 @@
+#include "model/model.h"
+#include "model/inventory.h"
+#include "check.h"
+
+using namespace nb;
+using test::check;
+
+namespace
+{
+  Piece brick(coord_t x, coord_t y, size2d_t size, PieceType type = PieceType::Square)
+  {
+    return Piece(coord2d_t(x, y), nullptr, PieceOrientation::North, type, size);
+  }
+}
+
+int main()
+{
+  /* the piece coming first by position keeps the stocked part, the other one is rebuilt from smaller parts */
+  {
+    nb::Model model;
+    model.addLayerOnTop();
+    model.addPiece(0, brick(4, 0, size2d_t(2, 2)));
+    model.addPiece(0, brick(0, 0, size2d_t(2, 2)));
+
+    Inventory inventory;
+    inventory.add(size2d_t(2, 2), Palette::NONE, PieceType::Square, 1);
+    inventory.add(size2d_t(1, 2), Palette::NONE, PieceType::Square, 2);
+
+    auto solution = InventorySolver::solve(model, inventory);
+    check(solution.replaced == 1 && solution.unresolved.empty(), "one piece is replaced");
+
+    model.apply(solution.batch);
+    auto kept = model.piece(coord3d_t(coord2d_t(0, 0), 0));
+    auto part = model.piece(coord3d_t(coord2d_t(4, 0), 0));
+    check(kept && kept->width() == 2 && kept->height() == 2, "first piece keeps the stocked part");
+    check(part && part->width() * part->height() == 2, "second piece is made of smaller parts");
+    check(model.layer(0)->pieces().size() == 3 && model.layer(0)->occupancy().count(bounds2d_t(coord2d_t(4, 0), coord2d_t(6, 2))) == 4, "replacement covers the same cells");
+  }
+
+  /* the same model and inventory always give the same solution, whatever the order pieces were added in */
+  {
+    nb::Model a, b;
+    a.addLayerOnTop();
+    b.addLayerOnTop();
+
+    for (coord_t i = 0; i < 8; ++i)
+    {
+      a.addPiece(0, brick(i * 100, i * 50, size2d_t(2, 4)));
+      b.addPiece(0, brick((7 - i) * 100, (7 - i) * 50, size2d_t(2, 4)));
+    }
+
+    Inventory inventory;
+    inventory.add(size2d_t(2, 4), Palette::NONE, PieceType::Square, 3);
+    inventory.add(size2d_t(2, 2), Palette::NONE, PieceType::Square, 20);
+
+    InventorySolver::solve(a, inventory);
+    auto first = InventorySolver::solve(a, inventory);
+    auto second = InventorySolver::solve(b, inventory);
+    a.apply(first.batch);
+    b.apply(second.batch);
+
+    bool same = true;
+    for (coord_t i = 0; i < 8; ++i)
+    {
+      auto pa = a.piece(coord3d_t(coord2d_t(i * 100, i * 50), 0)), pb = b.piece(coord3d_t(coord2d_t(i * 100, i * 50), 0));
+      same = same && pa && pb && pa->height() == pb->height();
+    }
+
+    check(first.replaced == 5 && second.replaced == 5, "pieces over stock are replaced");
+    check(same, "solutions don't depend on insertion order");
+    check(a.piece(coord3d_t(coord2d_t(0, 0), 0))->height() == 4, "pieces coming first keep the stocked parts");
+  }
+
+  /* round pieces and pieces without parts of their color are left unresolved */
+  {
+    nb::Model model;
+    model.addLayerOnTop();
+    PieceHandle round = model.addPiece(0, brick(0, 0, size2d_t(2, 2), PieceType::Round));
+
+    Inventory inventory;
+    inventory.add(size2d_t(1, 1), Palette::NONE, PieceType::Round, 4);
+
+    auto solution = InventorySolver::solve(model, inventory);
+    check(solution.replaced == 0 && solution.unresolved.size() == 1 && solution.unresolved.front() == round, "round piece can't be split");
+  }
+
+  return test::finish("inventory");
+}
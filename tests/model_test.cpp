@@ -0,0 +1,108 @@
+#include "model/model.h"
+#include "check.h"
+
+#include <vector>
+
+using namespace nb;
+using test::check;
+
+namespace
+{
+  Piece brick(coord_t x, coord_t y, size2d_t size = size2d_t(2, 2))
+  {
+    return Piece(coord2d_t(x, y), nullptr, PieceOrientation::North, PieceType::Square, size);
+  }
+}
+
+int main()
+{
+  /* preparing layers again doesn't give out the ids of the previous layers nor revive handles to their pieces */
+  {
+    nb::Model model;
+    model.prepareLayers(2);
+    const layer_id_t before = model.layer(1)->id();
+    PieceHandle handle = model.addPiece(1, brick(0, 0));
+    model.shift(coord2d_t(3, 0));
+
+    model.prepareLayers(2);
+    PieceHandle fresh = model.addPiece(1, brick(0, 0));
+
+    check(model.layer(0)->id() > before && model.layer(1)->id() > before, "new layers get ids never used before");
+    check(!model.valid(handle) && !model.piece(handle), "handles to pieces of the previous layers are invalid");
+    check(fresh && fresh != handle, "pieces of the new layers get new handles");
+    check(model.origin().x == 0 && model.origin().y == 0, "origin is reset");
+    check(model.bounds().min.x == 0 && model.bounds().max.x == 2, "bounds only hold the new pieces");
+  }
+
+  /* inserting a layer at the bottom keeps the ids of the others and the pieces found through them */
+  {
+    nb::Model model;
+    model.prepareLayers(2);
+    const layer_id_t top = model.layer(1)->id();
+    model.addPiece(1, brick(4, 4));
+
+    model.addLayerAtBottom();
+
+    check(model.layerCount() == 3 && model.layer(2)->id() == top && model.position(top) == 2, "layer keeps its id and moves up");
+    check(model.piece(coord3d_t(coord2d_t(5, 5), 2)).has_value(), "piece moved up with its layer");
+  }
+
+  /* range queries report each piece intersecting the box once, in world space, whatever chunks it spans */
+  {
+    nb::Model model;
+    model.prepareLayers(3);
+    PieceHandle wide = model.addPiece(0, brick(-40, -2, size2d_t(80, 4)));
+    PieceHandle inside = model.addPiece(0, brick(10, 10));
+    model.addPiece(0, brick(100, 100));
+    PieceHandle above = model.addPiece(1, brick(0, 0));
+    model.addPiece(2, brick(0, 0));
+
+    auto collect = [&model](const bounds3d_t& box) {
+      std::vector<PieceHandle> handles;
+      model.query(box, [&handles](const PieceRecord&, PieceHandle handle) { handles.push_back(handle); });
+      return handles;
+    };
+
+    auto contains = [](const std::vector<PieceHandle>& handles, PieceHandle handle) {
+      size_t count = 0;
+      for (PieceHandle h : handles)
+        count += h == handle;
+      return count == 1;
+    };
+
+    auto found = collect(bounds3d_t(bounds2d_t(coord2d_t(-50, -50), coord2d_t(50, 50)), 0, 2));
+    check(found.size() == 3 && contains(found, wide) && contains(found, inside) && contains(found, above), "box holds the pieces of its layers once each");
+
+    found = collect(bounds3d_t(bounds2d_t(coord2d_t(12, 12), coord2d_t(20, 20)), 0, 3));
+    check(found.empty(), "pieces touching the box only on its border aren't reported");
+
+    found = collect(bounds3d_t(bounds2d_t(coord2d_t(39, 1), coord2d_t(41, 3)), 0, 1));
+    check(found.size() == 1 && contains(found, wide), "piece spanning many chunks is found from its far end");
+
+    model.shift(coord2d_t(5, 0));
+    bool world = false;
+    model.query(bounds3d_t(bounds2d_t(coord2d_t(15, 10), coord2d_t(16, 11)), 0, 1), [&world, inside](const PieceRecord& record, PieceHandle handle) {
+      world = handle == inside && record.piece.x() == 15 && record.layer == 0;
+    });
+    check(world, "box and results are in world space after a shift");
+
+    found = collect(bounds3d_t(bounds2d_t(coord2d_t(-50, -50), coord2d_t(50, 50)), 5, 8));
+    check(found.empty(), "layers past the model are ignored");
+  }
+
+  /* journal cursors only make sense for the journal they were taken from */
+  {
+    nb::Model model;
+    model.prepareLayers(1);
+    model.addPiece(0, brick(0, 0));
+
+    const uint64_t id = model.journal().id();
+    nb::Model copy = model;
+    check(copy.journal().id() != id && copy.journal().version() == model.journal().version(), "copied journal keeps its changes under a new id");
+
+    nb::Model moved = std::move(model);
+    check(moved.journal().id() == id, "moved journal keeps its id");
+  }
+
+  return test::finish("model");
+}
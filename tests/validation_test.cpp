@@ -0,0 +1,84 @@
+#include "model/validation.h"
+#include "model/model.h"
+#include "check.h"
+
+#include <algorithm>
+
+using namespace nb;
+using test::check;
+
+namespace
+{
+  bool reported(const std::vector<Validator::Overlap>& overlaps, size_t first, size_t second)
+  {
+    return std::any_of(overlaps.begin(), overlaps.end(), [=](const Validator::Overlap& overlap) {
+      return overlap.first == first && overlap.second == second;
+    });
+  }
+}
+
+int main()
+{
+  /* three mutually overlapping pieces, the last one only covers cells the first one already owns */
+  {
+    std::vector<PieceRecord> pieces = {
+      { 0, Piece(coord2d_t(0, 0), nullptr, PieceOrientation::North, PieceType::Square, size2d_t(4, 4)) },
+      { 0, Piece(coord2d_t(1, 1), nullptr, PieceOrientation::North, PieceType::Square, size2d_t(2, 2)) },
+      { 0, Piece(coord2d_t(2, 2), nullptr, PieceOrientation::North, PieceType::Square, size2d_t(1, 1)) },
+    };
+
+    auto overlaps = Validator::validate(pieces);
+    check(overlaps.size() == 3, "three mutually overlapping pieces give three overlaps");
+    check(reported(overlaps, 0, 1), "second piece overlaps first one");
+    check(reported(overlaps, 0, 2), "third piece overlaps first one");
+    check(reported(overlaps, 1, 2), "third piece overlaps second one");
+  }
+
+  /* same pieces spread over different layers don't overlap */
+  {
+    std::vector<PieceRecord> pieces = {
+      { 0, Piece(coord2d_t(0, 0), nullptr, PieceOrientation::North, PieceType::Square, size2d_t(4, 4)) },
+      { 1, Piece(coord2d_t(1, 1), nullptr, PieceOrientation::North, PieceType::Square, size2d_t(2, 2)) },
+      { 2, Piece(coord2d_t(2, 2), nullptr, PieceOrientation::North, PieceType::Square, size2d_t(1, 1)) },
+    };
+
+    check(Validator::validate(pieces).empty(), "pieces on different layers don't overlap");
+  }
+
+  /* pieces crossing a chunk border are still reported once */
+  {
+    std::vector<PieceRecord> pieces = {
+      { 0, Piece(coord2d_t(-2, -2), nullptr, PieceOrientation::North, PieceType::Square, size2d_t(4, 4)) },
+      { 0, Piece(coord2d_t(-1, -1), nullptr, PieceOrientation::North, PieceType::Square, size2d_t(2, 2)) },
+    };
+
+    auto overlaps = Validator::validate(pieces);
+    check(overlaps.size() == 1 && reported(overlaps, 0, 1), "overlap across chunks is reported once");
+  }
+
+  /* the model rejects pieces which would overlap, so that its index keeps a single piece per cell */
+  {
+    nb::Model model;
+    model.addLayerOnTop();
+
+    PieceHandle first = model.addPiece(0, Piece(coord2d_t(0, 0), nullptr, PieceOrientation::North, PieceType::Square, size2d_t(4, 4)));
+    PieceHandle second = model.addPiece(0, Piece(coord2d_t(2, 2), nullptr, PieceOrientation::North, PieceType::Square, size2d_t(4, 4)));
+    PieceHandle third = model.addPiece(0, Piece(coord2d_t(4, 0), nullptr, PieceOrientation::North, PieceType::Square, size2d_t(2, 2)));
+
+    check(first && !second && third, "overlapping insertion is rejected");
+    check(!model.move(third, coord2d_t(-1, 0)), "movement onto another piece is rejected");
+    check(model.move(third, coord2d_t(1, 0)), "movement over the cells of the piece itself is accepted");
+
+    EditBatch batch;
+    batch.add(0, Piece(coord2d_t(0, 8), nullptr, PieceOrientation::North, PieceType::Square, size2d_t(2, 2)));
+    batch.add(0, Piece(coord2d_t(1, 8), nullptr, PieceOrientation::North, PieceType::Square, size2d_t(2, 2)));
+    auto handles = model.apply(batch);
+    check(handles[0] && !handles[1], "insertion overlapping an earlier one of the same batch is rejected");
+
+    model.remove(first);
+    check(model.handle(coord3d_t(coord2d_t(5, 1), 0)) == third, "remaining piece is still found after a removal");
+    check(!model.piece(coord3d_t(coord2d_t(1, 1), 0)), "cells of the removed piece are empty");
+  }
+
+  return test::finish("validation");
+}